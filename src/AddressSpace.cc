@@ -880,6 +880,27 @@ bool AddressSpace::has_rr_page() const {
   return it != mem.end() && (it->second.flags & Mapping::IS_RR_PAGE);
 }
 
+void AddressSpace::apply_mprotect_record(Task* t, const mprotect_record& r) {
+  switch (r.kind) {
+    case MPROTECT_RECORD_MPROTECT:
+      protect(t, r.start, r.size, r.prot);
+      break;
+    case MPROTECT_RECORD_MMAP:
+      // A size of zero means the mmap failed.
+      if (r.size) {
+        map(t, r.start, ceil_page_size(r.size), r.prot,
+            MAP_PRIVATE | MAP_ANONYMOUS, 0, string());
+      }
+      break;
+    case MPROTECT_RECORD_MUNMAP:
+      unmap(t, r.start, r.size);
+      break;
+    default:
+      ASSERT(t, false) << "Unknown mprotect_record kind " << r.kind;
+      break;
+  }
+}
+
 void AddressSpace::protect(Task* t, remote_ptr<void> addr, size_t num_bytes,
                            int prot) {
   LOG(debug) << "mprotect(" << addr << ", " << num_bytes << ", " << HEX(prot)
@@ -2354,6 +2375,19 @@ bool AddressSpace::is_stap_semaphore(remote_ptr<uint16_t> addr) {
   return stap_semaphores.find(addr) != stap_semaphores.end();
 }
 
+static void update_preload_globals_flag(RecordTask* rt,
+                                        remote_ptr<unsigned char> addr,
+                                        unsigned char value) {
+  bool ok = true;
+  if (rt->read_mem(addr, &ok) != value) {
+    if (!ok) {
+      return;
+    }
+    rt->write_mem(addr, value);
+    rt->record_local(addr, sizeof(value), &value);
+  }
+}
+
 void AddressSpace::fd_tables_changed() {
   if (!session()->is_recording()) {
     // All modifications are recorded during record
@@ -2374,15 +2408,25 @@ void AddressSpace::fd_tables_changed() {
       fdt_uniform = false;
     }
   }
-  auto addr = REMOTE_PTR_FIELD(rt->preload_globals, fdt_uniform);
-  bool ok = true;
-  if (rt->read_mem(addr, &ok) != fdt_uniform) {
-    if (!ok) {
-      return;
-    }
-    rt->write_mem(addr, fdt_uniform);
-    rt->record_local(addr, sizeof(fdt_uniform), &fdt_uniform);
+  update_preload_globals_flag(
+      rt, REMOTE_PTR_FIELD(rt->preload_globals, fdt_uniform), fdt_uniform);
+}
+
+void AddressSpace::task_set_changed() {
+  if (!session()->is_recording()) {
+    // All modifications are recorded during record
+    return;
+  }
+  if (!syscallbuf_enabled()) {
+    return;
+  }
+  RecordTask* rt = static_cast<RecordTask*>(first_running_task());
+  if (!rt) {
+    return;
   }
+  update_preload_globals_flag(
+      rt, REMOTE_PTR_FIELD(rt->preload_globals, single_task),
+      task_set().size() == 1);
 }
 
 } // namespace rr
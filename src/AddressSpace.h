@@ -531,6 +531,11 @@ public:
    */
   void protect(Task* t, remote_ptr<void> addr, size_t num_bytes, int prot);
 
+  /**
+   * Apply a layout change made by a buffered mprotect, mmap or munmap.
+   */
+  void apply_mprotect_record(Task* t, const mprotect_record& r);
+
   /**
    * Fix up mprotect registers parameters to take account of PROT_GROWSDOWN.
    */
@@ -846,6 +851,7 @@ public:
     this->HasTaskSet::erase_task(t);
     if (task_set().size() != 0) {
       fd_tables_changed();
+      task_set_changed();
     }
   }
 
@@ -856,6 +862,13 @@ public:
    */
   void fd_tables_changed();
 
+  /**
+   * Called when a task got added to or removed from this address space.
+   * Tells the syscallbuf whether it's the only task, in which case it
+   * can buffer sched_yield.
+   */
+  void task_set_changed();
+
   static MemoryRange get_global_exclusion_range(const RecordSession* session);
 
 private:
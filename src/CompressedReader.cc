@@ -12,6 +12,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <deque>
+#include <map>
+
 #include "CompressedWriter.h"
 #include "core.h"
 #include "util.h"
@@ -20,7 +23,298 @@ using namespace std;
 
 namespace rr {
 
-CompressedReader::CompressedReader(const string& filename)
+static bool read_all(const ScopedFd& fd, size_t size, void* data,
+                     uint64_t* offset) {
+  ssize_t ret = read_to_end(fd, *offset, data, size);
+  if (ret == (ssize_t)size) {
+    *offset += size;
+    return true;
+  }
+  return false;
+}
+
+static bool do_decompress(std::vector<uint8_t>& compressed,
+                          std::vector<uint8_t>& uncompressed) {
+  size_t out_size = uncompressed.size();
+  return BrotliDecoderDecompress(compressed.size(), compressed.data(),
+                                 &out_size, uncompressed.data()) ==
+             BROTLI_DECODER_RESULT_SUCCESS &&
+         out_size == uncompressed.size();
+}
+
+/**
+ * Reads and decompresses the block whose header is at |*offset|. On success,
+ * advances |*offset| past the block.
+ */
+static bool read_block(const ScopedFd& fd, uint64_t* offset,
+                       std::vector<uint8_t>& uncompressed) {
+  CompressedWriter::BlockHeader header;
+  if (!read_all(fd, sizeof(header), &header, offset)) {
+    return false;
+  }
+
+  if (header.codec == CompressedWriter::CODEC_STORED) {
+    uncompressed.resize(header.uncompressed_length);
+    return header.compressed_length == header.uncompressed_length &&
+           read_all(fd, uncompressed.size(), uncompressed.data(), offset);
+  }
+  if (header.codec != CompressedWriter::CODEC_BROTLI) {
+    return false;
+  }
+
+  std::vector<uint8_t> compressed_buf;
+  compressed_buf.resize(header.compressed_length);
+  if (!read_all(fd, compressed_buf.size(), compressed_buf.data(), offset)) {
+    return false;
+  }
+
+  uncompressed.resize(header.uncompressed_length);
+  return do_decompress(compressed_buf, uncompressed);
+}
+
+/**
+ * Decompresses blocks of a CompressedWriter file on worker threads, ahead of
+ * the positions that CompressedReaders are reading from. Blocks are
+ * identified by the file offset of their header. Decoded blocks are handed
+ * over to the first reader that asks for them.
+ */
+class BlockPrefetcher {
+public:
+  BlockPrefetcher(const std::shared_ptr<ScopedFd>& fd, size_t depth,
+                  const string& filename);
+  ~BlockPrefetcher();
+
+  /**
+   * Get the decompressed block at |offset|, waiting for a worker if it's
+   * being decompressed or decompressing it on this thread if no worker has
+   * started on it. Sets |*next_offset| to the offset of the following block.
+   */
+  bool take(uint64_t offset, std::vector<uint8_t>& data,
+            uint64_t* next_offset);
+  /**
+   * Queue up the |depth| blocks starting at |offset| for decompression.
+   */
+  void prefetch_from(uint64_t offset);
+  /**
+   * Return a block obtained from take() that the reader had to discard
+   * (e.g. in CompressedReader::restore_state) but is likely to need again.
+   */
+  void give_back(uint64_t offset, std::vector<uint8_t>& data,
+                 uint64_t next_offset);
+  /**
+   * Our worker threads don't survive fork(), and our mutex might have been
+   * held by one of them at the time, so a forked child must stop using us.
+   */
+  bool in_owner_process() const { return getpid() == owner_pid; }
+
+private:
+  struct Block {
+    enum State { QUEUED, DECOMPRESSING, READY, FAILED };
+    State state;
+    uint64_t next_offset;
+    std::vector<uint8_t> data;
+  };
+
+  static void* worker_thread_callback(void* p);
+  void worker_thread();
+  void evict_blocks_outside(uint64_t start, uint64_t end);
+
+  // Immutable while threads are running
+  std::shared_ptr<ScopedFd> fd;
+  size_t depth;
+  pid_t owner_pid;
+  std::vector<pthread_t> threads;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  // BEGIN protected by 'mutex'
+  std::map<uint64_t, Block> blocks;
+  std::deque<uint64_t> queue;
+  bool exiting;
+  // END protected by 'mutex'
+};
+
+BlockPrefetcher::BlockPrefetcher(const std::shared_ptr<ScopedFd>& fd,
+                                 size_t depth, const string& filename)
+    : fd(fd), depth(depth), owner_pid(getpid()), exiting(false) {
+  pthread_mutex_init(&mutex, nullptr);
+  pthread_cond_init(&cond, nullptr);
+
+  size_t num_threads = min<size_t>(depth, max(1, get_num_cpus() - 1));
+  threads.resize(num_threads);
+  size_t last_slash = filename.rfind('/');
+  string thread_name =
+      string("decompress ") + (last_slash == string::npos
+                                   ? filename
+                                   : filename.substr(last_slash + 1));
+  for (size_t i = 0; i < num_threads; ++i) {
+    while (true) {
+      int err = pthread_create(&threads[i], nullptr, worker_thread_callback,
+                               this);
+      if (err == EAGAIN) {
+        sched_yield(); // Give other processes a chance to exit.
+        continue;
+      } else if (err != 0) {
+        SAFE_FATAL(err, "Failed to create decompression threads!");
+      }
+      break;
+    }
+    pthread_setname_np(threads[i], thread_name.substr(0, 15).c_str());
+  }
+}
+
+BlockPrefetcher::~BlockPrefetcher() {
+  if (!in_owner_process()) {
+    return;
+  }
+  pthread_mutex_lock(&mutex);
+  exiting = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+
+  for (auto& t : threads) {
+    pthread_join(t, nullptr);
+  }
+  pthread_mutex_destroy(&mutex);
+  pthread_cond_destroy(&cond);
+}
+
+void* BlockPrefetcher::worker_thread_callback(void* p) {
+  static_cast<BlockPrefetcher*>(p)->worker_thread();
+  return nullptr;
+}
+
+void BlockPrefetcher::worker_thread() {
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    if (exiting) {
+      break;
+    }
+    if (queue.empty()) {
+      pthread_cond_wait(&cond, &mutex);
+      continue;
+    }
+
+    uint64_t offset = queue.front();
+    queue.pop_front();
+    auto it = blocks.find(offset);
+    if (it == blocks.end() || it->second.state != Block::QUEUED) {
+      // A reader got to this block first.
+      continue;
+    }
+    // Blocks in DECOMPRESSING state are never erased by anyone else, so
+    // 'it' stays valid while we drop the lock.
+    Block& block = it->second;
+    block.state = Block::DECOMPRESSING;
+    pthread_mutex_unlock(&mutex);
+
+    std::vector<uint8_t> data;
+    uint64_t next_offset = offset;
+    bool ok = read_block(*fd, &next_offset, data);
+
+    pthread_mutex_lock(&mutex);
+    block.state = ok ? Block::READY : Block::FAILED;
+    block.next_offset = next_offset;
+    block.data = std::move(data);
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+bool BlockPrefetcher::take(uint64_t offset, std::vector<uint8_t>& data,
+                           uint64_t* next_offset) {
+  pthread_mutex_lock(&mutex);
+  auto it = blocks.find(offset);
+  while (it != blocks.end() && it->second.state == Block::DECOMPRESSING) {
+    pthread_cond_wait(&cond, &mutex);
+    it = blocks.find(offset);
+  }
+  if (it != blocks.end() && it->second.state != Block::QUEUED) {
+    bool ok = it->second.state == Block::READY;
+    *next_offset = it->second.next_offset;
+    data = std::move(it->second.data);
+    blocks.erase(it);
+    pthread_mutex_unlock(&mutex);
+    return ok;
+  }
+  if (it != blocks.end()) {
+    // Queued but not started yet. It's quicker to do it ourselves than to
+    // wait for a worker to get to it. The worker will skip its stale
+    // queue entry.
+    blocks.erase(it);
+  }
+  pthread_mutex_unlock(&mutex);
+
+  *next_offset = offset;
+  return read_block(*fd, next_offset, data);
+}
+
+void BlockPrefetcher::prefetch_from(uint64_t offset) {
+  // Walk the block headers to find the offsets of the blocks we want.
+  // Headers are tiny so doing this on the reader thread is cheap.
+  vector<uint64_t> offsets;
+  uint64_t end = offset;
+  for (size_t i = 0; i < depth; ++i) {
+    CompressedWriter::BlockHeader header;
+    uint64_t header_offset = end;
+    if (!read_all(*fd, sizeof(header), &header, &end)) {
+      break;
+    }
+    offsets.push_back(header_offset);
+    end += header.compressed_length;
+  }
+
+  pthread_mutex_lock(&mutex);
+  evict_blocks_outside(offset, end);
+  bool queued = false;
+  for (uint64_t o : offsets) {
+    if (blocks.count(o)) {
+      continue;
+    }
+    Block& block = blocks[o];
+    block.state = Block::QUEUED;
+    block.next_offset = o;
+    queue.push_back(o);
+    queued = true;
+  }
+  if (queued) {
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void BlockPrefetcher::give_back(uint64_t offset, std::vector<uint8_t>& data,
+                                uint64_t next_offset) {
+  pthread_mutex_lock(&mutex);
+  if (!blocks.count(offset)) {
+    Block& block = blocks[offset];
+    block.state = Block::READY;
+    block.next_offset = next_offset;
+    block.data = std::move(data);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void BlockPrefetcher::evict_blocks_outside(uint64_t start, uint64_t end) {
+  // Leave some slack for blocks that were given back or that another copy
+  // of the reader is about to consume; beyond that, drop finished blocks
+  // that aren't in the window we're about to prefetch.
+  if (blocks.size() <= 2 * depth) {
+    return;
+  }
+  for (auto it = blocks.begin(); it != blocks.end();) {
+    bool finished = it->second.state == Block::READY ||
+                    it->second.state == Block::FAILED;
+    if (finished && (it->first < start || it->first >= end)) {
+      it = blocks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+CompressedReader::CompressedReader(const string& filename,
+                                   size_t decompress_ahead)
     : fd(new ScopedFd(filename.c_str(), O_CLOEXEC | O_RDONLY | O_LARGEFILE)) {
   fd_offset = 0;
   error = !fd->is_open();
@@ -29,43 +323,30 @@ CompressedReader::CompressedReader(const string& filename)
   } else {
     char ch;
     eof = pread(*fd, &ch, 1, fd_offset) == 0;
+    if (decompress_ahead > 0 && !eof) {
+      prefetcher = make_shared<BlockPrefetcher>(fd, decompress_ahead, filename);
+    }
   }
   buffer_read_pos = 0;
+  buffer_fd_offset = 0;
   have_saved_state = false;
 }
 
 CompressedReader::CompressedReader(const CompressedReader& other) {
   fd = other.fd;
+  prefetcher = other.prefetcher;
   fd_offset = other.fd_offset;
   error = other.error;
   eof = other.eof;
   buffer_read_pos = other.buffer_read_pos;
   buffer = other.buffer;
+  buffer_fd_offset = other.buffer_fd_offset;
   have_saved_state = false;
   DEBUG_ASSERT(!other.have_saved_state);
 }
 
 CompressedReader::~CompressedReader() { close(); }
 
-static bool read_all(const ScopedFd& fd, size_t size, void* data,
-                     uint64_t* offset) {
-  ssize_t ret = read_to_end(fd, *offset, data, size);
-  if (ret == (ssize_t)size) {
-    *offset += size;
-    return true;
-  }
-  return false;
-}
-
-static bool do_decompress(std::vector<uint8_t>& compressed,
-                          std::vector<uint8_t>& uncompressed) {
-  size_t out_size = uncompressed.size();
-  return BrotliDecoderDecompress(compressed.size(), compressed.data(),
-                                 &out_size, uncompressed.data()) ==
-             BROTLI_DECODER_RESULT_SUCCESS &&
-         out_size == uncompressed.size();
-}
-
 bool CompressedReader::get_buffer(const uint8_t** data, size_t* size) {
   if (error) {
     return false;
@@ -131,15 +412,18 @@ bool CompressedReader::refill_buffer() {
     have_saved_buffer = true;
   }
 
-  CompressedWriter::BlockHeader header;
-  if (!read_all(*fd, sizeof(header), &header, &fd_offset)) {
-    error = true;
-    return false;
+  if (prefetcher && !prefetcher->in_owner_process()) {
+    prefetcher = nullptr;
   }
-
-  std::vector<uint8_t> compressed_buf;
-  compressed_buf.resize(header.compressed_length);
-  if (!read_all(*fd, compressed_buf.size(), &compressed_buf[0], &fd_offset)) {
+  buffer_fd_offset = fd_offset;
+  buffer_read_pos = 0;
+  bool ok;
+  if (prefetcher) {
+    ok = prefetcher->take(buffer_fd_offset, buffer, &fd_offset);
+  } else {
+    ok = read_block(*fd, &fd_offset, buffer);
+  }
+  if (!ok) {
     error = true;
     return false;
   }
@@ -147,13 +431,8 @@ bool CompressedReader::refill_buffer() {
   char ch;
   if (pread(*fd, &ch, 1, fd_offset) == 0) {
     eof = true;
-  }
-
-  buffer.resize(header.uncompressed_length);
-  buffer_read_pos = 0;
-  if (!do_decompress(compressed_buf, buffer)) {
-    error = true;
-    return false;
+  } else if (prefetcher) {
+    prefetcher->prefetch_from(fd_offset);
   }
 
   return true;
@@ -163,11 +442,33 @@ void CompressedReader::rewind() {
   DEBUG_ASSERT(!have_saved_state);
   fd_offset = 0;
   buffer_read_pos = 0;
+  buffer_fd_offset = 0;
   buffer.clear();
   eof = false;
 }
 
-void CompressedReader::close() { fd = nullptr; }
+bool CompressedReader::seek(uint64_t block_fd_offset, size_t skip_bytes) {
+  DEBUG_ASSERT(!have_saved_state);
+  fd_offset = block_fd_offset;
+  buffer_read_pos = 0;
+  buffer_fd_offset = block_fd_offset;
+  buffer.clear();
+  char ch;
+  eof = pread(*fd, &ch, 1, fd_offset) == 0;
+  if (eof && skip_bytes > 0) {
+    error = true;
+    return false;
+  }
+  if (!eof && prefetcher && prefetcher->in_owner_process()) {
+    prefetcher->prefetch_from(fd_offset);
+  }
+  return skip(skip_bytes);
+}
+
+void CompressedReader::close() {
+  prefetcher = nullptr;
+  fd = nullptr;
+}
 
 void CompressedReader::save_state() {
   DEBUG_ASSERT(!have_saved_state);
@@ -175,6 +476,7 @@ void CompressedReader::save_state() {
   have_saved_buffer = false;
   saved_fd_offset = fd_offset;
   saved_buffer_read_pos = buffer_read_pos;
+  saved_buffer_fd_offset = buffer_fd_offset;
 }
 
 void CompressedReader::restore_state() {
@@ -183,12 +485,18 @@ void CompressedReader::restore_state() {
   if (saved_fd_offset < fd_offset) {
     eof = false;
   }
-  fd_offset = saved_fd_offset;
   if (have_saved_buffer) {
+    if (prefetcher && prefetcher->in_owner_process() && !error) {
+      // We're about to read this block again, so don't make the prefetcher
+      // decompress it a second time.
+      prefetcher->give_back(buffer_fd_offset, buffer, fd_offset);
+    }
     std::swap(buffer, saved_buffer);
     saved_buffer.clear();
   }
+  fd_offset = saved_fd_offset;
   buffer_read_pos = saved_buffer_read_pos;
+  buffer_fd_offset = saved_buffer_fd_offset;
 }
 
 void CompressedReader::discard_state() {
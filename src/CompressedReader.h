@@ -14,14 +14,19 @@
 
 namespace rr {
 
+class BlockPrefetcher;
+
 /**
  * CompressedReader opens an input file written by CompressedWriter
- * and reads data from it. Currently data is decompressed by the thread that
- * calls read().
+ * and reads data from it. By default data is decompressed by the thread that
+ * calls read(). If 'decompress_ahead' is nonzero, worker threads decompress
+ * up to that many blocks beyond the current read position so that read()
+ * usually finds the next block already decoded. Copies of a CompressedReader
+ * share the same worker threads and decoded blocks.
  */
 class CompressedReader {
 public:
-  CompressedReader(const std::string& filename);
+  CompressedReader(const std::string& filename, size_t decompress_ahead = 0);
   CompressedReader(const CompressedReader& aOther);
   ~CompressedReader();
   bool good() const { return !error; }
@@ -35,6 +40,11 @@ public:
   // Advances the read position by the given size.
   bool skip(size_t size);
   void rewind();
+  // Positions the reader 'skip_bytes' into the block whose header is at
+  // 'block_fd_offset'. 'block_fd_offset' may be the file size, in which
+  // case 'skip_bytes' must be zero and the reader is left at the end.
+  // Returns false (with good() false) if the block can't be read.
+  bool seek(uint64_t block_fd_offset, size_t skip_bytes);
   void close();
 
   /**
@@ -95,16 +105,21 @@ protected:
      Instead track the current position in fd_offset and use pread. */
   uint64_t fd_offset;
   std::shared_ptr<ScopedFd> fd;
+  // Null if we're not decompressing ahead.
+  std::shared_ptr<BlockPrefetcher> prefetcher;
   bool error;
   bool eof;
   std::vector<uint8_t> buffer;
   size_t buffer_read_pos;
+  // File offset of the block header for the data in 'buffer'.
+  uint64_t buffer_fd_offset;
 
   bool have_saved_state;
   bool have_saved_buffer;
   uint64_t saved_fd_offset;
   std::vector<uint8_t> saved_buffer;
   size_t saved_buffer_read_pos;
+  uint64_t saved_buffer_fd_offset;
 };
 
 } // namespace rr
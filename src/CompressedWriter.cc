@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "TraceSink.h"
 #include "core.h"
 #include "util.h"
 
@@ -19,11 +20,6 @@ using namespace std;
 
 namespace rr {
 
-/* See
- * http://robert.ocallahan.org/2017/07/selecting-compression-algorithm-for-rr.html
- */
-static const int BROTLI_LEVEL = 5;
-
 void* CompressedWriter::compression_thread_callback(void* p) {
   static_cast<CompressedWriter*>(p)->compression_thread();
   return nullptr;
@@ -47,6 +43,9 @@ CompressedWriter::CompressedWriter(const string& filename, size_t block_size,
   next_thread_end_pos = 0;
   closing = false;
   write_error = false;
+  level = DEFAULT_LEVEL;
+  max_level = DEFAULT_LEVEL;
+  next_block_fd_offset = 0;
 
   producer_reserved_pos = 0;
   producer_reserved_write_pos = 0;
@@ -111,7 +110,32 @@ void CompressedWriter::write(const void* data, size_t size) {
   }
 }
 
-void CompressedWriter::update_reservation(WaitFlag wait_flag) {
+uint8_t* CompressedWriter::reserve(size_t size) {
+  size_t buf_offset = (size_t)(producer_reserved_write_pos % buffer.size());
+  if (error || buf_offset + size > buffer.size()) {
+    return nullptr;
+  }
+  if (producer_reserved_upto_pos - producer_reserved_write_pos < size) {
+    update_reservation(WAIT, size);
+    if (error) {
+      return nullptr;
+    }
+  }
+  return &buffer[buf_offset];
+}
+
+void CompressedWriter::commit(size_t size) {
+  DEBUG_ASSERT(producer_reserved_write_pos + size <=
+               producer_reserved_upto_pos);
+  producer_reserved_write_pos += size;
+  if (!error &&
+      producer_reserved_write_pos - producer_reserved_pos >=
+          buffer.size() / 2) {
+    update_reservation(NOWAIT);
+  }
+}
+
+void CompressedWriter::update_reservation(WaitFlag wait_flag, size_t needed) {
   pthread_mutex_lock(&mutex);
 
   next_thread_end_pos = producer_reserved_write_pos;
@@ -131,7 +155,7 @@ void CompressedWriter::update_reservation(WaitFlag wait_flag) {
       completed_pos = min(completed_pos, thread_pos[i]);
     }
     producer_reserved_upto_pos = completed_pos + buffer.size();
-    if (producer_reserved_pos < producer_reserved_upto_pos ||
+    if (producer_reserved_pos + needed <= producer_reserved_upto_pos ||
         wait_flag == NOWAIT) {
       break;
     }
@@ -164,12 +188,30 @@ void CompressedWriter::compression_thread() {
       // therefore fits in a size_t.
       header->uncompressed_length =
           (size_t)(next_thread_pos - thread_pos[thread_index]);
+      int block_level = choose_level();
 
       pthread_mutex_unlock(&mutex);
-      header->compressed_length =
-          do_compress(thread_pos[thread_index], header->uncompressed_length,
-                      &outputbuf[sizeof(BlockHeader)],
-                      outputbuf.size() - sizeof(BlockHeader));
+      size_t compressed_length = 0;
+      if (block_level >= 0) {
+        compressed_length =
+            do_compress(thread_pos[thread_index], header->uncompressed_length,
+                        block_level, &outputbuf[sizeof(BlockHeader)],
+                        outputbuf.size() - sizeof(BlockHeader));
+      }
+      if (compressed_length > 0 &&
+          compressed_length < header->uncompressed_length) {
+        header->codec = CODEC_BROTLI;
+        header->level = block_level;
+      } else {
+        // We're falling behind, or the data didn't compress.
+        copy_uncompressed(thread_pos[thread_index],
+                          header->uncompressed_length,
+                          &outputbuf[sizeof(BlockHeader)]);
+        compressed_length = header->uncompressed_length;
+        header->codec = CODEC_STORED;
+        header->level = 0;
+      }
+      header->compressed_length = compressed_length;
       pthread_mutex_lock(&mutex);
 
       if (header->compressed_length == 0) {
@@ -191,9 +233,18 @@ void CompressedWriter::compression_thread() {
       }
 
       if (!write_error) {
+        uint64_t block_fd_offset = next_block_fd_offset;
+        size_t block_length = sizeof(BlockHeader) + header->compressed_length;
+        blocks_written.push_back({ block_fd_offset, thread_pos[thread_index] });
+        next_block_fd_offset += block_length;
+        shared_ptr<TraceSink> block_sink = sink;
         pthread_mutex_unlock(&mutex);
-        write_all(fd, &outputbuf[0],
-                  sizeof(BlockHeader) + header->compressed_length);
+        if (block_sink) {
+          block_sink->write(sink_name, block_fd_offset, &outputbuf[0],
+                            block_length);
+        } else {
+          write_all(fd, &outputbuf[0], block_length);
+        }
         pthread_mutex_lock(&mutex);
       }
 
@@ -215,6 +266,46 @@ void CompressedWriter::compression_thread() {
   pthread_mutex_unlock(&mutex);
 }
 
+void CompressedWriter::set_compression_level(int level, int max_level) {
+  DEBUG_ASSERT(level == ADAPTIVE_LEVEL || (level >= 0 && level <= MAX_LEVEL));
+  DEBUG_ASSERT(max_level >= 0 && max_level <= MAX_LEVEL);
+  pthread_mutex_lock(&mutex);
+  this->level = level;
+  this->max_level = max_level;
+  pthread_mutex_unlock(&mutex);
+}
+
+void CompressedWriter::set_sink(shared_ptr<TraceSink> sink,
+                                const string& name) {
+  pthread_mutex_lock(&mutex);
+  this->sink = sink;
+  sink_name = name;
+  pthread_mutex_unlock(&mutex);
+}
+
+// Call with 'mutex' held, after claiming a block. Returns a Brotli quality,
+// or -1 if the block should be stored uncompressed.
+int CompressedWriter::choose_level() {
+  if (level != ADAPTIVE_LEVEL) {
+    return level;
+  }
+  // The buffer has room for two blocks beyond the ones being compressed.
+  // Once the data waiting for a compression thread fills that, the
+  // producer stalls in write(), so get cheaper as we approach that.
+  uint64_t waiting = next_thread_end_pos - next_thread_pos;
+  uint64_t slack = buffer.size() - threads.size() * block_size;
+  if (waiting >= slack * 3 / 4) {
+    return -1;
+  }
+  if (waiting >= slack / 2) {
+    return min(max_level, 1);
+  }
+  if (waiting >= slack / 4) {
+    return min(max_level, 3);
+  }
+  return max_level;
+}
+
 void CompressedWriter::close(Sync sync) {
   if (!fd.is_open()) {
     return;
@@ -245,12 +336,13 @@ void CompressedWriter::close(Sync sync) {
 }
 
 size_t CompressedWriter::do_compress(uint64_t offset, size_t length,
-                                     uint8_t* outputbuf, size_t outputbuf_len) {
+                                     int level, uint8_t* outputbuf,
+                                     size_t outputbuf_len) {
   BrotliEncoderState* state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
   if (!state) {
     DEBUG_ASSERT(0 && "BrotliEncoderCreateInstance failed");
   }
-  if (!BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, BROTLI_LEVEL)) {
+  if (!BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, level)) {
     DEBUG_ASSERT(0 && "Brotli initialization failed");
   }
 
@@ -277,4 +369,16 @@ size_t CompressedWriter::do_compress(uint64_t offset, size_t length,
   return ret;
 }
 
+void CompressedWriter::copy_uncompressed(uint64_t offset, size_t length,
+                                         uint8_t* outputbuf) {
+  while (length > 0) {
+    size_t buf_offset = (size_t)(offset % buffer.size());
+    size_t amount = min(length, buffer.size() - buf_offset);
+    memcpy(outputbuf, &buffer[buf_offset], amount);
+    outputbuf += amount;
+    offset += amount;
+    length -= amount;
+  }
+}
+
 } // namespace rr
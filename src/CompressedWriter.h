@@ -14,12 +14,15 @@
 
 namespace rr {
 
+class TraceSink;
+
 /**
  * CompressedWriter opens an output file and writes compressed blocks to it.
  * Blocks of a fixed but unspecified size (currently 1MB) are compressed.
  * Each block of compressed data is written to the file preceded by two
- * 32-bit words: the size of the compressed data (excluding block header)
- * and the size of the uncompressed data, in that order. See BlockHeader below.
+ * 32-bit words: the size of the compressed data (excluding block header,
+ * with the codec and level packed into the top bits) and the size of the
+ * uncompressed data, in that order. See BlockHeader below.
  *
  * We use multiple threads to perform compression. The threads are
  * responsible for the actual data writes. The thread that creates the
@@ -38,15 +41,66 @@ public:
   bool good() const { return !error; }
   // Call only on producer thread.
   void write(const void* data, size_t size);
+  // Call only on producer thread. Returns 'size' bytes of our buffer where
+  // the next data written will go, so callers can produce data in place
+  // instead of passing it to write(). Returns null if that isn't possible
+  // (e.g. the space would wrap around the end of the buffer).
+  // Fill in the space, then pass the number of leading bytes to keep to
+  // commit(). commit() may be called several times to keep successive
+  // pieces of the space. Uncommitted bytes are discarded by the next
+  // write() or reserve().
+  uint8_t* reserve(size_t size);
+  void commit(size_t size);
   enum Sync { DONT_SYNC, SYNC };
   // Call only on producer thread
   void close(Sync sync = DONT_SYNC);
 
+  enum {
+    // Pass as 'level' to set_compression_level to choose a level for each
+    // block based on how far compression is lagging behind the producer.
+    ADAPTIVE_LEVEL = -1,
+    /* See
+     * http://robert.ocallahan.org/2017/07/selecting-compression-algorithm-for-rr.html
+     */
+    DEFAULT_LEVEL = 5,
+    MAX_LEVEL = 11
+  };
+  // Call only on producer thread. 'level' is a Brotli quality to use for
+  // every block, or ADAPTIVE_LEVEL. In adaptive mode blocks are compressed
+  // at 'max_level' when compression is keeping up, and at lower levels or
+  // not at all when it isn't.
+  void set_compression_level(int level, int max_level);
+  // Call only on producer thread. Blocks not yet written go to 'sink' as
+  // writes to 'name' at their file offset, instead of to our file. Our
+  // file keeps whatever was written before this call.
+  void set_sink(std::shared_ptr<TraceSink> sink, const std::string& name);
+
+  enum Codec { CODEC_BROTLI = 0, CODEC_STORED = 1 };
   struct BlockHeader {
-    uint32_t compressed_length;
+    uint32_t compressed_length : 24;
+    // A Codec. Always CODEC_BROTLI in traces from older rr versions.
+    uint32_t codec : 4;
+    // The Brotli quality used, for information only. Zero in traces from
+    // older rr versions.
+    uint32_t level : 4;
     uint32_t uncompressed_length;
   };
 
+  struct BlockLocation {
+    // File offset of the BlockHeader
+    uint64_t fd_offset;
+    // Offset of the block's first byte in the uncompressed stream
+    uint64_t uncompressed_offset;
+  };
+  // Call only on producer thread, after close(). Locations of all blocks
+  // written, in file order.
+  const std::vector<BlockLocation>& block_locations() const {
+    return blocks_written;
+  }
+  // Call only on producer thread. Total number of uncompressed bytes
+  // passed to write() so far.
+  uint64_t bytes_written() const { return producer_reserved_write_pos; }
+
   template <typename T> CompressedWriter& operator<<(const T& value) {
     write(&value, sizeof(value));
     return *this;
@@ -68,12 +122,15 @@ public:
 
 protected:
   enum WaitFlag { WAIT, NOWAIT };
-  void update_reservation(WaitFlag wait_flag);
+  // With WAIT, blocks until at least 'needed' bytes are reserved.
+  void update_reservation(WaitFlag wait_flag, size_t needed = 1);
 
   static void* compression_thread_callback(void* p);
   void compression_thread();
-  size_t do_compress(uint64_t offset, size_t length, uint8_t* outputbuf,
-                     size_t outputbuf_len);
+  int choose_level();
+  size_t do_compress(uint64_t offset, size_t length, int level,
+                     uint8_t* outputbuf, size_t outputbuf_len);
+  void copy_uncompressed(uint64_t offset, size_t length, uint8_t* outputbuf);
 
   // Immutable while threads are running
   ScopedFd fd;
@@ -95,6 +152,13 @@ protected:
   uint64_t next_thread_end_pos;
   bool closing;
   bool write_error;
+  int level;
+  int max_level;
+  /* file offset at which the next block will be written */
+  uint64_t next_block_fd_offset;
+  std::vector<BlockLocation> blocks_written;
+  std::shared_ptr<TraceSink> sink;
+  std::string sink_name;
   // END protected by 'mutex'
 
   /* producer thread only */
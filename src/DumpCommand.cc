@@ -145,6 +145,11 @@ static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
   }
   if (flags.dump_mmaps) {
     for (auto& record : frame.event().SyscallbufFlush().mprotect_records) {
+      if (record.kind == MPROTECT_RECORD_MUNMAP) {
+        fprintf(out, "  { munmap start:'%p', size:'%lx' }\n",
+                (void*)record.start, record.size);
+        continue;
+      }
       char prot_flags[] = "rwx";
       if (!(record.prot & PROT_READ)) {
         prot_flags[0] = '-';
@@ -155,7 +160,8 @@ static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
       if (!(record.prot & PROT_EXEC)) {
         prot_flags[2] = '-';
       }
-      fprintf(out, "  { start:'%p', size:'%lx', prot:%s }\n",
+      fprintf(out, "  { %sstart:'%p', size:'%lx', prot:%s }\n",
+              record.kind == MPROTECT_RECORD_MMAP ? "mmap " : "",
               (void*)record.start, record.size, prot_flags);
     }
   }
@@ -189,18 +195,29 @@ static void print_socket_addr(FILE* out, const struct NativeArch::sockaddr_stora
   }
 }
 
+static void print_socket_addrs(
+    FILE* out, const std::array<typename NativeArch::sockaddr_storage, 2>& addrs) {
+  fputs("  Local socket address '", out);
+  print_socket_addr(out, addrs[0]);
+  fputs("' Remote socket address '", out);
+  print_socket_addr(out, addrs[1]);
+  fputs("'\n", out);
+}
+
 static void dump_socket_addrs(FILE* out, const TraceFrame& frame) {
+  if (frame.event().type() == EV_SYSCALLBUF_FLUSH) {
+    for (auto& addrs : frame.event().SyscallbufFlush().socket_addrs) {
+      print_socket_addrs(out, addrs);
+    }
+    return;
+  }
   if (frame.event().type() != EV_SYSCALL) {
     return;
   }
 
   auto syscall = frame.event().Syscall();
   if (syscall.socket_addrs) {
-    fputs("  Local socket address '", out);
-    print_socket_addr(out, (*syscall.socket_addrs.get())[0]);
-    fputs("' Remote socket address '", out);
-    print_socket_addr(out, (*syscall.socket_addrs.get())[1]);
-    fputs("'\n", out);
+    print_socket_addrs(out, *syscall.socket_addrs.get());
   }
 }
 
@@ -257,6 +274,14 @@ static void dump_events_matching(TraceReader& trace, const DumpFlags& flags,
     }
   }
 
+  // Skip over the frames we're not interested in without decompressing
+  // them, if the trace has an index.
+  if (only_end) {
+    trace.seek_to_frame(numeric_limits<FrameTime>::max());
+  } else if (start > trace.time() + 1) {
+    trace.seek_to_frame(start);
+  }
+
   bool process_raw_data =
       flags.dump_syscallbuf || flags.dump_recorded_data_metadata;
   while (!trace.at_end()) {
@@ -327,6 +352,10 @@ static void dump_events_matching(TraceReader& trace, const DumpFlags& flags,
         if (flags.dump_recorded_data_metadata) {
           fprintf(out, "  { tid:%d, addr:%p, length:%p", data.rec_tid,
                   (void*)data.addr.as_int(), (void*)data.size);
+          if (data.dedup_offset != TraceReader::NOT_DEDUPLICATED) {
+            fprintf(out, ", dedup_offset:0x%llx",
+                    (long long)data.dedup_offset);
+          }
           if (!data.holes.empty()) {
             fputs(", holes:[", out);
             bool first = true;
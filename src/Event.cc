@@ -119,6 +119,7 @@ bool Event::has_ticks_slop() const {
     case EV_SYSCALLBUF_ABORT_COMMIT:
     case EV_SYSCALLBUF_FLUSH:
     case EV_SYSCALLBUF_RESET:
+    case EV_SYSCALLBUF_RESIZE:
     case EV_DESCHED:
     case EV_GROW_MAP:
       return true;
@@ -206,6 +207,7 @@ std::string Event::type_name() const {
       CASE(SYSCALLBUF_FLUSH);
       CASE(SYSCALLBUF_ABORT_COMMIT);
       CASE(SYSCALLBUF_RESET);
+      CASE(SYSCALLBUF_RESIZE);
       CASE(PATCH_SYSCALL);
       CASE(GROW_MAP);
       CASE(DESCHED);
@@ -73,6 +73,9 @@ enum EventType {
   // the event *after* a syscallbuf flush and then reset the syscallbuf,
   // to ensure we don't reset it while preload code is still using the data.
   EV_SYSCALLBUF_RESET,
+  // The (empty) syscallbuf was replaced by one of a different size. This is
+  // associated with a mmap entry for the new buffer.
+  EV_SYSCALLBUF_RESIZE,
   // Syscall was entered, the syscall instruction was patched, and the
   // syscall was aborted. Resume execution at the patch.
   EV_PATCH_SYSCALL,
@@ -138,6 +141,9 @@ struct SchedEvent {
 struct SyscallbufFlushEvent {
   SyscallbufFlushEvent() {}
   std::vector<mprotect_record> mprotect_records;
+  // Local and remote addresses of connections made by buffered syscalls.
+  std::vector<std::array<typename NativeArch::sockaddr_storage, 2>>
+      socket_addrs;
 };
 
 enum SignalDeterministic { NONDETERMINISTIC_SIG = 0, DETERMINISTIC_SIG = 1 };
@@ -403,6 +409,7 @@ struct Event {
     return Event(EV_SYSCALLBUF_ABORT_COMMIT);
   }
   static Event syscallbuf_reset() { return Event(EV_SYSCALLBUF_RESET); }
+  static Event syscallbuf_resize() { return Event(EV_SYSCALLBUF_RESIZE); }
   static Event grow_map() { return Event(EV_GROW_MAP); }
   static Event exit() { return Event(EV_EXIT); }
   static Event sentinel() { return Event(EV_SENTINEL); }
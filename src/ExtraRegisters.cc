@@ -643,6 +643,73 @@ bool ExtraRegisters::set_to_raw_data(SupportedArch a, Format format,
   return true;
 }
 
+bool ExtraRegisters::has_xsave_header() const {
+  return format_ == XSAVE && data_.size() >= xsave_header_end;
+}
+
+// Calls f(index, layout) for each component after the legacy area that
+// is in use according to 'features' and that 'layout' has an area for.
+template <typename F>
+static void for_each_used_xsave_component(uint64_t features,
+                                          const XSaveLayout& layout, F f) {
+  for (size_t i = 2; i < 64 && i < layout.feature_layouts.size(); ++i) {
+    if ((features & (uint64_t(1) << i)) && layout.feature_layouts[i].size) {
+      f(i, layout.feature_layouts[i]);
+    }
+  }
+}
+
+vector<uint8_t> ExtraRegisters::get_xsave_without_init_components() const {
+  DEBUG_ASSERT(has_xsave_header());
+  uint64_t features;
+  memcpy(&features, data_.data() + xsave_header_offset, sizeof(features));
+  vector<uint8_t> result(data_.begin(), data_.begin() + xsave_header_end);
+  for_each_used_xsave_component(
+      features, xsave_native_layout(),
+      [&](size_t, const XSaveFeatureLayout& feature) {
+        DEBUG_ASSERT(feature.offset + feature.size <= data_.size());
+        result.insert(result.end(), data_.begin() + feature.offset,
+                      data_.begin() + feature.offset + feature.size);
+      });
+  return result;
+}
+
+bool ExtraRegisters::set_to_xsave_without_init_components(
+    SupportedArch a, const uint8_t* data, size_t data_size,
+    const XSaveLayout& layout) {
+  if (data_size < xsave_header_end || layout.full_size < xsave_header_end) {
+    LOG(error) << "Invalid XSAVE data length: " << data_size;
+    return false;
+  }
+  uint64_t features;
+  memcpy(&features, data + xsave_header_offset, sizeof(features));
+  // Rebuild the uncompacted area with init-state components zeroed, which
+  // is what set_to_raw_data does with them anyway.
+  vector<uint8_t> full(layout.full_size);
+  memcpy(full.data(), data, xsave_header_end);
+  size_t offset = xsave_header_end;
+  bool ok = true;
+  for_each_used_xsave_component(
+      features, layout, [&](size_t i, const XSaveFeatureLayout& feature) {
+        if (!ok) {
+          return;
+        }
+        if (offset + feature.size > data_size ||
+            uint64_t(feature.offset) + feature.size > full.size()) {
+          LOG(error) << "Invalid XSAVE component " << i;
+          ok = false;
+          return;
+        }
+        memcpy(full.data() + feature.offset, data + offset, feature.size);
+        offset += feature.size;
+      });
+  if (!ok || offset != data_size) {
+    LOG(error) << "Invalid XSAVE data length: " << data_size;
+    return false;
+  }
+  return set_to_raw_data(a, XSAVE, full.data(), full.size(), layout);
+}
+
 vector<uint8_t> ExtraRegisters::get_user_fpregs_struct(
     SupportedArch arch) const {
   switch (arch) {
@@ -66,6 +66,19 @@ public:
   // if this could not be done.
   bool set_to_raw_data(SupportedArch a, Format format, const uint8_t* data,
                        size_t data_size, const XSaveLayout& layout);
+  // Returns our XSAVE data with the areas of the components that XSTATE_BV
+  // says are in their initial state left out. The legacy area and XSAVE
+  // header come first, then each remaining component in feature bit order.
+  // Only valid when has_xsave_header().
+  std::vector<uint8_t> get_xsave_without_init_components() const;
+  // Like set_to_raw_data with XSAVE format, for data produced by
+  // get_xsave_without_init_components() on a CPU with XSAVE layout 'layout'.
+  bool set_to_xsave_without_init_components(SupportedArch a,
+                                            const uint8_t* data,
+                                            size_t data_size,
+                                            const XSaveLayout& layout);
+  // True if we have XSAVE data that includes the XSAVE header.
+  bool has_xsave_header() const;
   Format format() const { return format_; }
   SupportedArch arch() const { return arch_; }
   const std::vector<uint8_t> data() const { return data_; }
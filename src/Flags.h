@@ -73,6 +73,12 @@ struct Flags {
   // User override for the path to page files and other resources.
   std::string resource_path;
 
+  // Number of trace blocks per substream to decompress ahead of the read
+  // position on background threads. DECOMPRESS_AHEAD_DEFAULT means use the
+  // per-substream default; 0 disables background decompression.
+  enum { DECOMPRESS_AHEAD_DEFAULT = -1 };
+  int decompress_ahead;
+
   Flags()
       : checksum(CHECKSUM_NONE),
         dump_on(DUMP_ON_NONE),
@@ -83,7 +89,8 @@ struct Flags {
         suppress_environment_warnings(false),
         fatal_errors_and_warnings(false),
         disable_cpuid_faulting(false),
-        disable_ptrace_exit_events(false) {}
+        disable_ptrace_exit_events(false),
+        decompress_ahead(DECOMPRESS_AHEAD_DEFAULT) {}
 
   static const Flags& get() { return singleton; }
 
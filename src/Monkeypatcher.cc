@@ -11,6 +11,7 @@
 #include "AutoRemoteSyscalls.h"
 #include "ElfReader.h"
 #include "Flags.h"
+#include "PatchSiteCache.h"
 #include "RecordSession.h"
 #include "RecordTask.h"
 #include "ReplaySession.h"
@@ -148,6 +149,7 @@ void Monkeypatcher::init_dynamic_syscall_patching(
 template <typename Arch>
 static bool patch_syscall_with_hook_arch(Monkeypatcher& patcher, RecordTask* t,
                                          const syscall_patch_hook& hook,
+                                         remote_code_ptr ip,
                                          size_t instruction_length,
                                          uint32_t fake_syscall_number);
 
@@ -510,22 +512,20 @@ template <typename JumpPatch, typename ExtendedJumpPatch, typename FakeSyscallEx
 static bool patch_syscall_with_hook_x86ish(Monkeypatcher& patcher,
                                            RecordTask* t,
                                            const syscall_patch_hook& hook,
+                                           remote_code_ptr ip,
                                            size_t instruction_length,
                                            uint32_t fake_syscall_number) {
   uint8_t jump_patch[instruction_length + hook.patch_region_length];
   // We're patching in a relative jump, so we need to compute the offset from
   // the end of the jump to our actual destination.
-  auto jump_patch_start = t->regs().ip().to_data_ptr<uint8_t>();
-  auto jump_patch_end = jump_patch_start + JumpPatch::size;
-  auto return_addr = t->regs().ip().to_data_ptr<uint8_t>().as_int() +
-                     instruction_length +
-                     hook.patch_region_length;
+  auto jump_patch_start = ip.to_data_ptr<uint8_t>();
+  auto return_addr = ip.to_data_ptr<uint8_t>().as_int() + instruction_length;
   if ((hook.flags & PATCH_SYSCALL_INSTRUCTION_IS_LAST)) {
-    auto adjust = hook.patch_region_length + instruction_length;
-    jump_patch_start -= adjust;
-    jump_patch_end -= adjust;
-    return_addr -= adjust;
+    jump_patch_start -= hook.patch_region_length;
+  } else {
+    return_addr += hook.patch_region_length;
   }
+  auto jump_patch_end = jump_patch_start + JumpPatch::size;
 
   remote_ptr<uint8_t> extended_jump_start;
   if (fake_syscall_number) {
@@ -582,12 +582,13 @@ template <>
 bool patch_syscall_with_hook_arch<X86Arch>(Monkeypatcher& patcher,
                                            RecordTask* t,
                                            const syscall_patch_hook& hook,
+                                           remote_code_ptr ip,
                                            size_t instruction_length,
                                            uint32_t fake_syscall_number) {
   return patch_syscall_with_hook_x86ish<X86SysenterVsyscallSyscallHook,
                                         X86SyscallStubExtendedJump,
                                         X86TrapInstructionStubExtendedJump>(patcher, t,
-                                                                            hook, instruction_length,
+                                                                            hook, ip, instruction_length,
                                                                             fake_syscall_number);
 }
 
@@ -595,12 +596,13 @@ template <>
 bool patch_syscall_with_hook_arch<X64Arch>(Monkeypatcher& patcher,
                                            RecordTask* t,
                                            const syscall_patch_hook& hook,
+                                           remote_code_ptr ip,
                                            size_t instruction_length,
                                            uint32_t fake_syscall_number) {
   return patch_syscall_with_hook_x86ish<X64JumpMonkeypatch,
                                         X64SyscallStubExtendedJump,
                                         X64TrapInstructionStubExtendedJump>(patcher, t,
-                                                                            hook, instruction_length,
+                                                                            hook, ip, instruction_length,
                                                                             fake_syscall_number);
 }
 
@@ -608,10 +610,10 @@ template <>
 bool patch_syscall_with_hook_arch<ARM64Arch>(Monkeypatcher& patcher,
                                              RecordTask *t,
                                              const syscall_patch_hook &hook,
+                                             remote_code_ptr ip,
                                              size_t,
                                              uint32_t) {
-  Registers r = t->regs();
-  remote_ptr<uint8_t> svc_ip = r.ip().to_data_ptr<uint8_t>();
+  remote_ptr<uint8_t> svc_ip = ip.to_data_ptr<uint8_t>();
   std::vector<uint32_t> inst_buff;
 
   remote_ptr<uint8_t> extended_jump_start =
@@ -664,12 +666,16 @@ bool patch_syscall_with_hook_arch<ARM64Arch>(Monkeypatcher& patcher,
 }
 
 
+/**
+ * `ip` is the address of the syscall or trapping instruction.
+ */
 static bool patch_syscall_with_hook(Monkeypatcher& patcher, RecordTask* t,
                                     const syscall_patch_hook& hook,
+                                    remote_code_ptr ip,
                                     size_t instruction_length,
                                     uint32_t fake_syscall_number) {
   RR_ARCH_FUNCTION(patch_syscall_with_hook_arch, t->arch(), patcher, t, hook,
-                        instruction_length, fake_syscall_number);
+                        ip, instruction_length, fake_syscall_number);
 }
 
 template <typename ExtendedJumpPatch>
@@ -887,6 +893,20 @@ static bool task_safe_for_syscall_patching(RecordTask* t, remote_code_ptr start,
   return true;
 }
 
+// The range of code that patching the instruction at `ip` with `hook`
+// overwrites.
+static void patched_range(const syscall_patch_hook& hook, remote_code_ptr ip,
+                          size_t instruction_length, remote_code_ptr* start,
+                          remote_code_ptr* end) {
+  if (hook.flags & PATCH_SYSCALL_INSTRUCTION_IS_LAST) {
+    *start = ip - hook.patch_region_length;
+    *end = ip + instruction_length;
+  } else {
+    *start = ip;
+    *end = ip + instruction_length + hook.patch_region_length;
+  }
+}
+
 static bool safe_for_syscall_patching(remote_code_ptr start,
                                       remote_code_ptr end,
                                       RecordTask* exclude) {
@@ -1034,13 +1054,7 @@ const syscall_patch_hook* Monkeypatcher::find_syscall_hook(RecordTask* t,
 
     if (!found_potential_interfering_branch) {
       remote_code_ptr start_range, end_range;
-      if (hook.flags & PATCH_SYSCALL_INSTRUCTION_IS_LAST) {
-        start_range = ip - hook.patch_region_length;
-        end_range = ip + instruction_length;
-      } else {
-        start_range = ip;
-        end_range = ip + instruction_length + hook.patch_region_length;
-      }
+      patched_range(hook, ip, instruction_length, &start_range, &end_range);
       if (!safe_for_syscall_patching(start_range, end_range, t)) {
         LOG(debug)
             << "Temporarily declining to patch syscall at " << ip
@@ -1094,7 +1108,9 @@ bool Monkeypatcher::try_patch_syscall_x86ish(RecordTask* t, bool entering_syscal
     LOG(debug) << "Patching syscall at " << ip << " syscall "
                << syscall_name(syscallno, t->arch()) << " tid " << t->tid;
 
-    success = patch_syscall_with_hook(*this, t, *hook_ptr, instruction_length, 0);
+    success = patch_syscall_with_hook(*this, t, *hook_ptr,
+                                      ip - instruction_length,
+                                      instruction_length, 0);
     if (!success && entering_syscall) {
       // Need to reenter the syscall to undo exit_syscall_and_prepare_restart
       t->enter_syscall();
@@ -1110,6 +1126,8 @@ bool Monkeypatcher::try_patch_syscall_x86ish(RecordTask* t, bool entering_syscal
     return false;
   }
 
+  note_patched_site(t, ip - instruction_length,
+                    PatchSiteCache::SYSCALL_INSTRUCTION, instruction_length);
   return true;
 }
 
@@ -1157,7 +1175,7 @@ bool Monkeypatcher::try_patch_syscall_aarch64(RecordTask* t, bool entering_sysca
   LOG(debug) << "Patching syscall at " << ip << " syscall "
              << syscall_name(r.original_syscallno(), aarch64) << " tid " << t->tid;
 
-  auto success = patch_syscall_with_hook(*this, t, syscall_hooks[0], 4, 0);
+  auto success = patch_syscall_with_hook(*this, t, syscall_hooks[0], ip, 4, 0);
   if (!success && entering_syscall) {
     // Need to reenter the syscall to undo exit_syscall_and_prepare_restart
     t->enter_syscall();
@@ -1170,6 +1188,7 @@ bool Monkeypatcher::try_patch_syscall_aarch64(RecordTask* t, bool entering_sysca
     return false;
   }
 
+  note_patched_site(t, ip, PatchSiteCache::SYSCALL_INSTRUCTION, 4);
   return true;
 }
 
@@ -1261,7 +1280,8 @@ bool Monkeypatcher::try_patch_trapping_instruction(RecordTask* t, size_t instruc
   if (hook_ptr) {
     LOG(debug) << "Patching trapping instruction at " << ip << " tid " << t->tid;
 
-    success = patch_syscall_with_hook(*this, t, *hook_ptr, instruction_length, SYS_rrcall_rdtsc);
+    success = patch_syscall_with_hook(*this, t, *hook_ptr, ip, instruction_length,
+                                      SYS_rrcall_rdtsc);
   }
 
   if (!success) {
@@ -1270,9 +1290,137 @@ bool Monkeypatcher::try_patch_trapping_instruction(RecordTask* t, size_t instruc
     return false;
   }
 
+  note_patched_site(t, ip, PatchSiteCache::TRAPPING_INSTRUCTION,
+                    instruction_length);
   return true;
 }
 
+void Monkeypatcher::note_patched_site(RecordTask* t, remote_code_ptr ip,
+                                      PatchSiteCache::SiteKind kind,
+                                      size_t instruction_length) {
+  remote_ptr<void> addr = ip.to_data_ptr<void>();
+  if (!t->vm()->has_mapping(addr)) {
+    return;
+  }
+  // Patching may have added mappings, so don't hold on to a reference.
+  KernelMapping km = t->vm()->mapping_of(addr).map;
+  PatchSiteCache& cache = PatchSiteCache::get();
+  string build_id = cache.build_id(t, km);
+  if (build_id.empty()) {
+    return;
+  }
+  PatchSiteCache::Site site = { addr - km.start() + km.file_offset_bytes(),
+                                kind, (uint8_t)instruction_length };
+  cache.add_site(t->arch(), build_id, site);
+}
+
+bool Monkeypatcher::apply_cached_site(RecordTask* t, remote_code_ptr ip,
+                                      const PatchSiteCache::Site& site) {
+  size_t instruction_length = site.instruction_length;
+  const syscall_patch_hook* hook_ptr;
+  uint32_t fake_syscall_number = 0;
+  remote_code_ptr start_range, end_range;
+  if (t->arch() == aarch64) {
+    // The same checks as try_patch_syscall_aarch64.
+    uint32_t inst[2] = {0, 0};
+    if (site.kind != PatchSiteCache::SYSCALL_INSTRUCTION ||
+        instruction_length != 4 || syscall_hooks.size() != 1 ||
+        t->read_bytes_fallible(ip.to_data_ptr<uint8_t>() - 4, 8, &inst) <
+            (ssize_t)sizeof(inst) ||
+        inst[1] != 0xd4000001 || inst[0] == 0xd2801b88 ||
+        !safe_for_syscall_patching(ip, ip + 4, t)) {
+      return false;
+    }
+    hook_ptr = &syscall_hooks[0];
+    start_range = ip;
+    end_range = ip + 4;
+  } else {
+    if (site.kind == PatchSiteCache::SYSCALL_INSTRUCTION) {
+      SupportedArch arch;
+      if (!get_syscall_instruction_arch(t, ip, &arch) || arch != t->arch() ||
+          (ssize_t)instruction_length != rr::syscall_instruction_length(arch)) {
+        return false;
+      }
+    } else {
+      if (trapped_instruction_at(t, ip) != TrappedInstruction::RDTSC ||
+          instruction_length !=
+              trapped_instruction_len(TrappedInstruction::RDTSC)) {
+        return false;
+      }
+      fake_syscall_number = SYS_rrcall_rdtsc;
+    }
+    hook_ptr = find_syscall_hook(
+        t, ip, site.kind == PatchSiteCache::SYSCALL_INSTRUCTION, false,
+        instruction_length);
+    if (!hook_ptr) {
+      return false;
+    }
+    patched_range(*hook_ptr, ip, instruction_length, &start_range, &end_range);
+  }
+  // The checks above skip |t| itself, which isn't at the site (it's exiting
+  // a syscall) but might have an interrupted syscall there.
+  if (!task_safe_for_syscall_patching(t, start_range, end_range)) {
+    return false;
+  }
+
+  LOG(debug) << "Patching cached site at " << ip << " tid " << t->tid;
+  return patch_syscall_with_hook(*this, t, *hook_ptr, ip, instruction_length,
+                                 fake_syscall_number);
+}
+
+bool Monkeypatcher::apply_cached_patches(RecordTask* t) {
+  if (cached_patch_ranges.empty()) {
+    return false;
+  }
+  vector<MemoryRange> ranges;
+  ranges.swap(cached_patch_ranges);
+  if (syscall_hooks.empty() || t->emulated_ptracer) {
+    return false;
+  }
+
+  PatchSiteCache& cache = PatchSiteCache::get();
+  bool flushed = false;
+  bool patched = false;
+  for (const auto& range : ranges) {
+    if (!t->vm()->has_mapping(range.start())) {
+      continue;
+    }
+    KernelMapping km = t->vm()->mapping_of(range.start()).map;
+    if (!(km.prot() & PROT_EXEC)) {
+      continue;
+    }
+    string build_id = cache.build_id(t, km);
+    if (build_id.empty()) {
+      continue;
+    }
+    for (const auto& site : cache.sites(t->arch(), build_id)) {
+      if (site.offset < km.file_offset_bytes()) {
+        continue;
+      }
+      remote_ptr<uint8_t> addr = km.start().cast<uint8_t>() +
+                                 (site.offset - km.file_offset_bytes());
+      MemoryRange site_range(addr, site.instruction_length);
+      if (!range.contains(site_range) || !km.contains(site_range)) {
+        continue;
+      }
+      remote_code_ptr ip = addr.as_int();
+      if (tried_to_patch_syscall_addresses.count(ip + site.instruction_length)) {
+        continue;
+      }
+      if (!flushed) {
+        // We want our mmap records to be associated with the PATCH_SYSCALL
+        // event our caller records, not a FLUSH_SYSCALLBUF event.
+        t->maybe_flush_syscallbuf();
+        flushed = true;
+      }
+      if (apply_cached_site(t, ip, site)) {
+        patched = true;
+      }
+    }
+  }
+  return patched;
+}
+
 // VDSOs are filled with overhead critical functions related to getting the
 // time and current CPU.  We need to ensure that these syscalls get redirected
 // into actual trap-into-the-kernel syscalls so rr can intercept them.
@@ -1394,6 +1542,14 @@ void Monkeypatcher::patch_at_preload_init(RecordTask* t) {
   // we're processing the rrcall, because it's masked off all
   // signals.
   RR_ARCH_FUNCTION(patch_at_preload_init_arch, t->arch(), t, *this);
+
+  if (!syscall_hooks.empty()) {
+    for (const auto& m : t->vm()->maps()) {
+      if (m.map.prot() & PROT_EXEC) {
+        cached_patch_ranges.push_back(MemoryRange(m.map.start(), m.map.end()));
+      }
+    }
+  }
 }
 
 static remote_ptr<void> resolve_address(ElfReader& reader, uintptr_t elf_addr,
@@ -1514,6 +1670,9 @@ void Monkeypatcher::patch_after_mmap(RecordTask* t, remote_ptr<void> start,
                                      size_t size, size_t offset_bytes,
                                      int child_fd, MmapMode mode) {
   const auto& map = t->vm()->mapping_of(start);
+  if (!syscall_hooks.empty() && (map.map.prot() & PROT_EXEC)) {
+    cached_patch_ranges.push_back(MemoryRange(start, size));
+  }
   if (file_may_need_instrumentation(map) &&
       (t->arch() == x86 || t->arch() == x86_64)) {
     ScopedFd open_fd;
@@ -9,6 +9,8 @@
 
 #include "preload/preload_interface.h"
 
+#include "MemoryRange.h"
+#include "PatchSiteCache.h"
 #include "remote_code_ptr.h"
 #include "remote_ptr.h"
 
@@ -33,6 +35,10 @@ class Task;
  * 3) Patch syscall instructions whose following instructions match a known
  * pattern to call the syscall hook.
  *
+ * 4) Patch the instructions that PatchSiteCache says earlier recordings
+ * patched in a file, as soon as the file is mapped, rather than waiting for
+ * each of them to trap first.
+ *
  * Monkeypatcher only runs during recording, never replay.
  */
 class Monkeypatcher {
@@ -78,6 +84,15 @@ public:
    */
   bool try_patch_trapping_instruction(RecordTask* t, size_t instruction_length);
 
+  /**
+   * Patch the cached sites of the files mapped since the last call. Call this
+   * at syscall exit, after the syscall's event has been recorded. If this
+   * returns true, something was patched and the caller must record a
+   * PATCH_SYSCALL event with patch_after_syscall set, so the patches are
+   * replayed.
+   */
+  bool apply_cached_patches(RecordTask* t);
+
   /**
    * Replace all extended jumps by syscalls again. Note that we do not try to
    * patch the original locations, since we don't know what the tracee may have
@@ -154,6 +169,12 @@ private:
                                               bool entering_syscall,
                                               size_t instruction_length);
 
+  void note_patched_site(RecordTask* t, remote_code_ptr ip,
+                         PatchSiteCache::SiteKind kind,
+                         size_t instruction_length);
+  bool apply_cached_site(RecordTask* t, remote_code_ptr ip,
+                         const PatchSiteCache::Site& site);
+
   /**
    * The list of supported syscall patches obtained from the preload
    * library. Each one matches a specific byte signature for the instruction(s)
@@ -165,6 +186,10 @@ private:
    * instructions that we've tried (or are currently trying) to patch.
    */
   std::unordered_set<remote_code_ptr> tried_to_patch_syscall_addresses;
+  /**
+   * Executable mappings whose cached patch sites haven't been applied yet.
+   */
+  std::vector<MemoryRange> cached_patch_ranges;
 };
 
 } // namespace rr
@@ -535,6 +535,10 @@ static void rewrite_mmaps(const map<string, string>& file_map,
   // "rr pack" that runs to completion will clean them all up.
   // AFTER this point, we have altered the mmaps file and the trace remains
   // valid.
+
+  // The trace index records positions in the old mmaps file. Without it,
+  // readers just read sequentially.
+  unlink(trace.index_path().c_str());
   string mmaps_path = trace_dir + "/mmaps";
   if (rename(path.c_str(), mmaps_path.c_str()) < 0) {
     FATAL() << "Error renaming " << path << " to " << mmaps_path;
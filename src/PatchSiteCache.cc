@@ -0,0 +1,184 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "PatchSiteCache.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "AddressSpace.h"
+#include "ElfReader.h"
+#include "RecordTask.h"
+#include "ScopedFd.h"
+#include "kernel_metadata.h"
+#include "log.h"
+#include "util.h"
+
+using namespace std;
+
+namespace rr {
+
+PatchSiteCache PatchSiteCache::singleton;
+
+// Like ensure_dir, but failing to create the cache just disables it.
+static bool make_dirs(const string& dir) {
+  struct stat st;
+  if (stat(dir.c_str(), &st) == 0) {
+    return S_ISDIR(st.st_mode);
+  }
+  size_t last_slash = dir.find_last_of('/');
+  if (last_slash != string::npos && last_slash > 0 &&
+      !make_dirs(dir.substr(0, last_slash))) {
+    return false;
+  }
+  return mkdir(dir.c_str(), S_IRWXU) == 0 || errno == EEXIST;
+}
+
+bool PatchSiteCache::enabled() {
+  if (!initialized) {
+    initialized = true;
+    if (getenv("RR_DISABLE_PATCH_SITE_CACHE")) {
+      return false;
+    }
+    const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg_cache_home && xdg_cache_home[0] == '/') {
+      dir = string(xdg_cache_home) + "/rr/patch-sites";
+    } else if (home && home[0] == '/') {
+      dir = string(home) + "/.cache/rr/patch-sites";
+    }
+    if (!dir.empty() && !make_dirs(dir)) {
+      LOG(warn) << "Can't create patch site cache " << dir;
+      dir.clear();
+    }
+  }
+  return !dir.empty();
+}
+
+string PatchSiteCache::file_path(const Key& key) {
+  return dir + "/" + arch_name(key.first) + "-" + key.second;
+}
+
+static void read_sites(const string& path, set<PatchSiteCache::Site>* sites) {
+  ifstream in(path);
+  char kind;
+  uint64_t offset;
+  unsigned int instruction_length;
+  while (in >> kind >> hex >> offset >> dec >> instruction_length) {
+    if ((kind != 's' && kind != 't') || instruction_length == 0 ||
+        instruction_length > 15) {
+      LOG(warn) << "Ignoring corrupt patch site cache file " << path;
+      return;
+    }
+    PatchSiteCache::Site site = {
+      offset,
+      kind == 's' ? PatchSiteCache::SYSCALL_INSTRUCTION
+                  : PatchSiteCache::TRAPPING_INSTRUCTION,
+      (uint8_t)instruction_length
+    };
+    sites->insert(site);
+  }
+}
+
+PatchSiteCache::Entry& PatchSiteCache::entry(const Key& key) {
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    it = entries.insert(make_pair(key, Entry())).first;
+    if (enabled()) {
+      read_sites(file_path(key), &it->second.sites);
+    }
+  }
+  return it->second;
+}
+
+string PatchSiteCache::build_id(RecordTask* t, const KernelMapping& km) {
+  if (!enabled()) {
+    return string();
+  }
+  char buf[100];
+  sprintf(buf, "/proc/%d/map_files/%llx-%llx", t->tid,
+          (long long)km.start().as_int(), (long long)km.end().as_int());
+  // Reading these directly requires CAP_SYS_ADMIN, so open the link target
+  // instead.
+  char link[PATH_MAX];
+  int ret = readlink(buf, link, sizeof(link) - 1);
+  if (ret < 0) {
+    return string();
+  }
+  link[ret] = 0;
+  ScopedFd fd(link, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (!fd.is_open() || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    return string();
+  }
+  // The path may have been replaced since it was mapped.
+  if (st.st_dev != km.device() || st.st_ino != km.inode()) {
+    LOG(debug) << link << " is no longer the file mapped at " << km;
+    return string();
+  }
+  FileId id = { st.st_dev, st.st_ino, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+  auto it = build_ids.find(id);
+  if (it == build_ids.end()) {
+    ElfFileReader reader(fd, t->arch());
+    it = build_ids.insert(make_pair(id, reader.read_buildid())).first;
+  }
+  return it->second;
+}
+
+const set<PatchSiteCache::Site>& PatchSiteCache::sites(
+    SupportedArch arch, const string& build_id) {
+  return entry(Key(arch, build_id)).sites;
+}
+
+void PatchSiteCache::add_site(SupportedArch arch, const string& build_id,
+                              const Site& site) {
+  if (build_id.empty() || !enabled()) {
+    return;
+  }
+  Entry& e = entry(Key(arch, build_id));
+  if (e.sites.insert(site).second) {
+    e.dirty = true;
+  }
+}
+
+void PatchSiteCache::save() {
+  for (auto& it : entries) {
+    Entry& e = it.second;
+    if (!e.dirty) {
+      continue;
+    }
+    e.dirty = false;
+
+    // Another recording may have saved sites since we loaded ours.
+    string path = file_path(it.first);
+    read_sites(path, &e.sites);
+    stringstream ss;
+    for (const Site& site : e.sites) {
+      ss << (site.kind == SYSCALL_INSTRUCTION ? 's' : 't') << ' ' << hex
+         << site.offset << ' ' << dec << (unsigned int)site.instruction_length
+         << '\n';
+    }
+    string data = ss.str();
+
+    // Write a new file and rename it over the old one so readers never see
+    // a partial file.
+    string tmp_path = path + ".XXXXXX";
+    ScopedFd fd(mkostemp(&tmp_path[0], O_CLOEXEC));
+    if (!fd.is_open()) {
+      LOG(warn) << "Can't create " << tmp_path;
+      continue;
+    }
+    if (pwrite_all_fallible(fd, data.data(), data.size(), 0) !=
+            (ssize_t)data.size() ||
+        rename(tmp_path.c_str(), path.c_str()) < 0) {
+      LOG(warn) << "Can't write patch site cache file " << path;
+      unlink(tmp_path.c_str());
+    }
+  }
+}
+
+} // namespace rr
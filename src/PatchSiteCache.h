@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#ifndef RR_PATCH_SITE_CACHE_H_
+#define RR_PATCH_SITE_CACHE_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+
+#include "kernel_abi.h"
+
+namespace rr {
+
+class KernelMapping;
+class RecordTask;
+
+/**
+ * A per-user, on-disk record of the instructions Monkeypatcher has patched,
+ * so that later recordings can patch them as soon as their file is mapped
+ * instead of waiting for each one to trap first.
+ *
+ * Sites are file offsets, stored in one file per (architecture, ELF build-id)
+ * under $XDG_CACHE_HOME/rr/patch-sites (default ~/.cache/rr/patch-sites).
+ * Files without a build-id aren't cached. The cache only says where to look:
+ * Monkeypatcher re-checks every site against the code and the preload
+ * library's current hooks before patching it.
+ *
+ * Set RR_DISABLE_PATCH_SITE_CACHE to neither read nor write the cache.
+ */
+class PatchSiteCache {
+public:
+  enum SiteKind { SYSCALL_INSTRUCTION, TRAPPING_INSTRUCTION };
+  struct Site {
+    uint64_t offset;
+    SiteKind kind;
+    uint8_t instruction_length;
+    bool operator<(const Site& other) const {
+      return std::tie(offset, kind, instruction_length) <
+             std::tie(other.offset, other.kind, other.instruction_length);
+    }
+  };
+
+  static PatchSiteCache& get() { return singleton; }
+
+  /**
+   * Returns the build-id of the file mapped by |km| in |t|, or the empty
+   * string if it has none, can't be read, or is no longer the file |km|
+   * refers to.
+   */
+  std::string build_id(RecordTask* t, const KernelMapping& km);
+
+  /**
+   * The cached sites of the file with |build_id|, loaded from disk on first
+   * use.
+   */
+  const std::set<Site>& sites(SupportedArch arch, const std::string& build_id);
+
+  void add_site(SupportedArch arch, const std::string& build_id,
+                const Site& site);
+
+  /**
+   * Merge the sites added since the last save into the files on disk.
+   * Errors are logged and otherwise ignored.
+   */
+  void save();
+
+private:
+  PatchSiteCache() : initialized(false) {}
+
+  struct Entry {
+    std::set<Site> sites;
+    bool dirty = false;
+  };
+  typedef std::pair<SupportedArch, std::string> Key;
+  struct FileId {
+    dev_t device;
+    ino_t inode;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    bool operator<(const FileId& other) const {
+      return std::tie(device, inode, mtime_sec, mtime_nsec) <
+             std::tie(other.device, other.inode, other.mtime_sec,
+                      other.mtime_nsec);
+    }
+  };
+
+  bool enabled();
+  std::string file_path(const Key& key);
+  Entry& entry(const Key& key);
+
+  std::string dir;
+  bool initialized;
+  std::map<Key, Entry> entries;
+  std::map<FileId, std::string> build_ids;
+
+  static PatchSiteCache singleton;
+};
+
+} // namespace rr
+
+#endif /* RR_PATCH_SITE_CACHE_H_ */
@@ -0,0 +1,280 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "Command.h"
+#include "TraceSink.h"
+#include "TraceStream.h"
+#include "core.h"
+#include "log.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+namespace rr {
+
+class ReceiveCommand : public Command {
+public:
+  virtual int run(vector<string>& args) override;
+
+protected:
+  ReceiveCommand(const char* name, const char* help) : Command(name, help) {}
+
+  static ReceiveCommand singleton;
+};
+
+ReceiveCommand ReceiveCommand::singleton(
+    "receive",
+    " rr receive [OPTION]... <SOCKET|FD>\n"
+    "  Rebuild a trace sent by `rr record --stream`. Listens on Unix socket\n"
+    "  <SOCKET> and accepts one connection, or reads from file descriptor\n"
+    "  <FD>. Prints the trace directory when the trace is complete.\n"
+    "  -o, --output-trace-dir=<DIR> put the trace in <DIR> instead of\n"
+    "                             under the default trace directory\n");
+
+struct ReceiveFlags {
+  string output_trace_dir;
+};
+
+static bool parse_receive_arg(vector<string>& args, ReceiveFlags& flags) {
+  if (parse_global_option(args)) {
+    return true;
+  }
+
+  static const OptionSpec options[] = {
+    { 'o', "output-trace-dir", HAS_PARAMETER },
+  };
+  ParsedOption opt;
+  if (!Command::parse_option(args, options, &opt)) {
+    return false;
+  }
+
+  switch (opt.short_name) {
+    case 'o':
+      flags.output_trace_dir = opt.value;
+      break;
+    default:
+      DEBUG_ASSERT(0 && "Unknown receive option");
+  }
+  return true;
+}
+
+static ScopedFd open_input(const string& spec) {
+  char* end;
+  long n = strtol(spec.c_str(), &end, 10);
+  if (!spec.empty() && !*end) {
+    return ScopedFd(n);
+  }
+
+  // Clear out a socket left behind by an earlier receive, but never
+  // anything else.
+  struct stat st;
+  if (lstat(spec.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      CLEAN_FATAL() << spec << " already exists and is not a socket";
+    }
+    unlink(spec.c_str());
+  }
+  ScopedFd sock = ScopedFd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!sock.is_open()) {
+    FATAL() << "Can't create Unix socket " << spec;
+  }
+  if (spec.size() + 1 > sizeof(sockaddr_un::sun_path)) {
+    CLEAN_FATAL() << "Socket file name " << spec << " too long";
+  }
+  sockaddr_un addr;
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, spec.c_str());
+  if (::bind(sock, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+    CLEAN_FATAL() << "Can't bind Unix socket " << spec;
+  }
+  if (listen(sock, 1) < 0) {
+    FATAL() << "Can't listen on Unix socket " << spec;
+  }
+  ScopedFd conn(accept4(sock, nullptr, nullptr, SOCK_CLOEXEC));
+  if (!conn.is_open()) {
+    FATAL() << "Can't accept connection on " << spec;
+  }
+  unlink(spec.c_str());
+  return conn;
+}
+
+// Returns false on EOF before 'size' bytes.
+static bool read_exactly(int fd, void* buf, size_t size) {
+  char* p = static_cast<char*>(buf);
+  while (size > 0) {
+    ssize_t ret = ::read(fd, p, size);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      FATAL() << "Can't read trace stream";
+    }
+    if (ret == 0) {
+      return false;
+    }
+    p += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+static bool read_string(int fd, size_t size, string* out) {
+  if (size > PATH_MAX) {
+    return false;
+  }
+  out->resize(size);
+  return read_exactly(fd, &(*out)[0], size);
+}
+
+// Names come from another process, so make sure they can't escape the
+// trace directory.
+static bool is_valid_name(const string& name) {
+  if (name.empty() || name[0] == '/') {
+    return false;
+  }
+  size_t start = 0;
+  while (true) {
+    size_t slash = name.find('/', start);
+    string component = name.substr(start, slash - start);
+    if (component.empty() || component == "." || component == "..") {
+      return false;
+    }
+    if (slash == string::npos) {
+      return true;
+    }
+    start = slash + 1;
+  }
+}
+
+static string make_receive_dir(const string& trace_name,
+                               const string& output_trace_dir) {
+  if (!output_trace_dir.empty()) {
+    if (mkdir(output_trace_dir.c_str(), S_IRWXU | S_IRWXG) < 0) {
+      CLEAN_FATAL() << "Unable to create trace directory `"
+                    << output_trace_dir << "'";
+    }
+    return output_trace_dir;
+  }
+
+  ensure_dir(trace_save_dir(), "trace directory", S_IRWXU);
+  int nonce = 0;
+  while (true) {
+    stringstream ss;
+    ss << trace_save_dir() << "/" << trace_name;
+    if (nonce > 0) {
+      ss << "-" << nonce;
+    }
+    string dir = ss.str();
+    if (mkdir(dir.c_str(), S_IRWXU | S_IRWXG) == 0) {
+      return dir;
+    }
+    if (errno != EEXIST) {
+      FATAL() << "Unable to create trace directory `" << dir << "'";
+    }
+    ++nonce;
+  }
+}
+
+static int receive(int fd, const ReceiveFlags& flags) {
+  TraceSink::StreamHeader header;
+  if (!read_exactly(fd, &header, sizeof(header)) ||
+      memcmp(header.magic, TraceSink::MAGIC, sizeof(header.magic))) {
+    fprintf(stderr, "Input is not an rr trace stream\n");
+    return 1;
+  }
+  if (header.version != TraceSink::STREAM_VERSION) {
+    fprintf(stderr, "Unsupported trace stream version %u\n", header.version);
+    return 1;
+  }
+  string trace_name;
+  if (!read_string(fd, header.name_length, &trace_name) ||
+      !is_valid_name(trace_name) || trace_name.find('/') != string::npos) {
+    fprintf(stderr, "Invalid trace name in stream\n");
+    return 1;
+  }
+
+  string dir = make_receive_dir(trace_name, flags.output_trace_dir);
+  map<string, ScopedFd> files;
+  vector<uint8_t> buf(1024 * 1024);
+  while (true) {
+    TraceSink::RecordHeader record;
+    if (!read_exactly(fd, &record, sizeof(record))) {
+      fprintf(stderr, "Trace stream ended early; incomplete trace left in %s\n",
+              dir.c_str());
+      return 1;
+    }
+    if (record.kind == TraceSink::RECORD_END) {
+      break;
+    }
+    string name;
+    if (record.kind != TraceSink::RECORD_WRITE ||
+        !read_string(fd, record.name_length, &name) || !is_valid_name(name)) {
+      fprintf(stderr, "Corrupt trace stream; incomplete trace left in %s\n",
+              dir.c_str());
+      return 1;
+    }
+
+    auto it = files.find(name);
+    if (it == files.end()) {
+      string path = dir + "/" + name;
+      for (size_t slash = path.find('/', dir.size() + 1);
+           slash != string::npos; slash = path.find('/', slash + 1)) {
+        string parent = path.substr(0, slash);
+        if (mkdir(parent.c_str(), S_IRWXU) < 0 && errno != EEXIST) {
+          FATAL() << "Can't create " << parent;
+        }
+      }
+      ScopedFd file(path.c_str(), O_CLOEXEC | O_WRONLY | O_CREAT,
+                    S_IRUSR | S_IWUSR);
+      if (!file.is_open()) {
+        FATAL() << "Can't create " << path;
+      }
+      it = files.insert(make_pair(name, std::move(file))).first;
+    }
+
+    uint64_t offset = record.offset;
+    uint64_t remaining = record.data_length;
+    while (remaining > 0) {
+      size_t size = min<uint64_t>(remaining, buf.size());
+      if (!read_exactly(fd, buf.data(), size)) {
+        fprintf(stderr, "Trace stream ended early; incomplete trace left in %s\n",
+                dir.c_str());
+        return 1;
+      }
+      if (pwrite_all_fallible(it->second, buf.data(), size, offset) !=
+          (ssize_t)size) {
+        FATAL() << "Can't write " << dir << "/" << name;
+      }
+      offset += size;
+      remaining -= size;
+    }
+  }
+
+  fprintf(stdout, "%s\n", dir.c_str());
+  return 0;
+}
+
+int ReceiveCommand::run(vector<string>& args) {
+  ReceiveFlags flags;
+  while (parse_receive_arg(args, flags)) {
+  }
+  if (args.size() != 1 || !verify_not_option(args)) {
+    print_help(stderr);
+    return 1;
+  }
+
+  ScopedFd fd = open_input(args[0]);
+  return receive(fd, flags);
+}
+
+} // namespace rr
@@ -0,0 +1,292 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include <dirent.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Command.h"
+#include "CompressedReader.h"
+#include "CompressedWriter.h"
+#include "ScopedFd.h"
+#include "TraceStream.h"
+#include "core.h"
+#include "log.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+namespace rr {
+
+class RecompressCommand : public Command {
+public:
+  virtual int run(vector<string>& args) override;
+
+protected:
+  RecompressCommand(const char* name, const char* help) : Command(name, help) {}
+
+  static RecompressCommand singleton;
+};
+
+RecompressCommand RecompressCommand::singleton(
+    "recompress",
+    " rr recompress [OPTION]... [<trace-dir>]\n"
+    "  --block-size=<KB>          compress in blocks of at least <KB>\n"
+    "                             kilobytes (64-8192). Larger blocks\n"
+    "                             compress better. By default each substream\n"
+    "                             keeps the block size used when recording\n"
+    "  --compression-level=<N>    Brotli quality to use (0-11). Default 11\n"
+    "  -o, --output-trace-dir=<DIR> write the recompressed trace to <DIR>\n"
+    "                             instead of replacing the trace's files\n"
+    "\n"
+    "Rewrites all trace data at a higher compression level, using all cores.\n"
+    "In-place recompression replaces one file at a time; the trace stays\n"
+    "valid if it's interrupted.\n");
+
+struct RecompressFlags {
+  size_t block_size;
+  int level;
+  string output_trace_dir;
+  RecompressFlags() : block_size(0), level(CompressedWriter::MAX_LEVEL) {}
+};
+
+static bool parse_recompress_arg(vector<string>& args, RecompressFlags& flags) {
+  if (parse_global_option(args)) {
+    return true;
+  }
+
+  static const OptionSpec options[] = {
+    { 0, "block-size", HAS_PARAMETER },
+    { 1, "compression-level", HAS_PARAMETER },
+    { 'o', "output-trace-dir", HAS_PARAMETER },
+  };
+  ParsedOption opt;
+  auto args_copy = args;
+  if (!Command::parse_option(args_copy, options, &opt)) {
+    return false;
+  }
+
+  switch (opt.short_name) {
+    case 0:
+      // Compressed block lengths must fit in BlockHeader's 24 bits.
+      if (!opt.verify_valid_int(64, 8192)) {
+        return false;
+      }
+      flags.block_size = opt.int_value * 1024;
+      break;
+    case 1:
+      if (!opt.verify_valid_int(0, CompressedWriter::MAX_LEVEL)) {
+        return false;
+      }
+      flags.level = opt.int_value;
+      break;
+    case 'o':
+      flags.output_trace_dir = opt.value;
+      break;
+    default:
+      DEBUG_ASSERT(0 && "Unknown recompress option");
+  }
+
+  args = args_copy;
+  return true;
+}
+
+static uint64_t file_size(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    FATAL() << "Can't stat " << path;
+  }
+  return st.st_size;
+}
+
+static vector<CompressedWriter::BlockLocation> recompress_substream(
+    const string& in_path, const string& out_path, size_t block_size,
+    int level) {
+  CompressedReader reader(in_path, 4);
+  CompressedWriter writer(out_path, block_size, get_num_cpus());
+  if (!writer.good()) {
+    FATAL() << "Unable to create " << out_path;
+  }
+  writer.set_compression_level(level, level);
+  while (true) {
+    const uint8_t* data;
+    size_t size;
+    if (!reader.get_buffer(&data, &size)) {
+      FATAL() << "Error reading " << in_path;
+    }
+    if (!size) {
+      break;
+    }
+    writer.write(data, size);
+    reader.skip(size);
+  }
+  // Try not to lose data!
+  writer.close(CompressedWriter::SYNC);
+  if (!writer.good()) {
+    FATAL() << "Error writing " << out_path;
+  }
+  return writer.block_locations();
+}
+
+// Link (or if that fails, copy) everything except the substreams, the index
+// and the version file from 'in_dir' to 'out_dir'.
+static void copy_other_files(const string& in_dir, const string& out_dir,
+                             bool top_level) {
+  DIR* dir = opendir(in_dir.c_str());
+  if (!dir) {
+    FATAL() << "Can't open directory " << in_dir;
+  }
+  vector<string> names;
+  struct dirent* d;
+  while ((d = readdir(dir)) != nullptr) {
+    if (strcmp(d->d_name, ".") && strcmp(d->d_name, "..")) {
+      names.push_back(d->d_name);
+    }
+  }
+  closedir(dir);
+
+  for (auto& name : names) {
+    if (top_level) {
+      bool skip = name == "index" || name == "version";
+      for (TraceStream::Substream s = TraceStream::SUBSTREAM_FIRST;
+           s < TraceStream::SUBSTREAM_COUNT;
+           s = (TraceStream::Substream)(s + 1)) {
+        skip = skip || name == TraceStream::substream_file_name(s);
+      }
+      if (skip) {
+        continue;
+      }
+    }
+    string in_path = in_dir + "/" + name;
+    string out_path = out_dir + "/" + name;
+    struct stat st;
+    if (lstat(in_path.c_str(), &st) < 0) {
+      FATAL() << "Can't stat " << in_path;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      if (mkdir(out_path.c_str(), st.st_mode & 07777) < 0) {
+        FATAL() << "Can't create " << out_path;
+      }
+      copy_other_files(in_path, out_path, false);
+    } else if (S_ISLNK(st.st_mode)) {
+      vector<char> target(st.st_size + 1);
+      ssize_t len = readlink(in_path.c_str(), target.data(), target.size());
+      if (len < 0 || symlink(string(target.data(), len).c_str(),
+                             out_path.c_str()) < 0) {
+        FATAL() << "Can't copy symlink " << in_path;
+      }
+    } else if (link(in_path.c_str(), out_path.c_str()) < 0) {
+      ScopedFd src(in_path.c_str(), O_RDONLY | O_CLOEXEC);
+      ScopedFd dest(out_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    st.st_mode & 0777);
+      if (!src.is_open() || !dest.is_open() || !copy_file(dest, src)) {
+        FATAL() << "Can't copy " << in_path << " to " << out_path;
+      }
+    }
+  }
+}
+
+static int recompress(const string& trace_dir, const RecompressFlags& flags) {
+  string dir;
+  {
+    // validate trace and produce default trace directory if trace_dir is empty
+    TraceReader reader(trace_dir);
+    dir = reader.dir();
+  }
+
+  bool in_place = flags.output_trace_dir.empty();
+  string out_dir = flags.output_trace_dir;
+  if (!in_place) {
+    if (mkdir(out_dir.c_str(), S_IRWXU | S_IRWXG) < 0) {
+      CLEAN_FATAL() << "Unable to create trace directory `" << out_dir << "'";
+    }
+    copy_other_files(dir, out_dir, true);
+  }
+
+  const char* tmp_suffix = in_place ? ".recompress" : "";
+  uint64_t old_size = 0;
+  uint64_t new_size = 0;
+  vector<CompressedWriter::BlockLocation> blocks[TraceStream::SUBSTREAM_COUNT];
+  for (TraceStream::Substream s = TraceStream::SUBSTREAM_FIRST;
+       s < TraceStream::SUBSTREAM_COUNT; s = (TraceStream::Substream)(s + 1)) {
+    string name = TraceStream::substream_file_name(s);
+    string in_path = dir + "/" + name;
+    string out_path = (in_place ? dir : out_dir) + "/" + name + tmp_suffix;
+    // Clean up after an interrupted run.
+    if (in_place) {
+      unlink(out_path.c_str());
+    }
+    size_t block_size =
+        max(flags.block_size, TraceStream::substream_block_size(s));
+    blocks[s] = recompress_substream(in_path, out_path, block_size, flags.level);
+    old_size += file_size(in_path);
+    new_size += file_size(out_path);
+  }
+
+  string index_path = dir + "/index";
+  string new_index_path =
+      (in_place ? dir : out_dir) + "/index" + tmp_suffix;
+  if (in_place) {
+    unlink(new_index_path.c_str());
+  }
+  bool has_index =
+      TraceWriter::rewrite_index(index_path, new_index_path, blocks);
+
+  if (in_place) {
+    // BEFORE this point, we haven't altered any of the original trace files.
+    // The old index doesn't match the new substreams, so remove it first;
+    // without it, readers just read sequentially. Each substream file has
+    // the same contents whether recompressed or not, so the trace is valid
+    // after every step.
+    unlink(index_path.c_str());
+    for (TraceStream::Substream s = TraceStream::SUBSTREAM_FIRST;
+         s < TraceStream::SUBSTREAM_COUNT;
+         s = (TraceStream::Substream)(s + 1)) {
+      string path = dir + "/" + TraceStream::substream_file_name(s);
+      string tmp_path = path + tmp_suffix;
+      if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        FATAL() << "Error renaming " << tmp_path << " to " << path;
+      }
+    }
+    if (has_index && rename(new_index_path.c_str(), index_path.c_str()) < 0) {
+      FATAL() << "Error renaming " << new_index_path << " to " << index_path;
+    }
+  } else {
+    // The version file goes last so an interrupted copy isn't mistaken for
+    // a complete trace.
+    string version_path = dir + "/version";
+    string new_version_path = out_dir + "/version";
+    ScopedFd src(version_path.c_str(), O_RDONLY | O_CLOEXEC);
+    ScopedFd dest(new_version_path.c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0400);
+    if (!src.is_open() || !dest.is_open() || !copy_file(dest, src) ||
+        fsync(dest) < 0) {
+      FATAL() << "Can't copy " << version_path << " to " << new_version_path;
+    }
+  }
+
+  if (!probably_not_interactive(STDOUT_FILENO)) {
+    printf("rr: Recompressed trace directory `%s' (%llu -> %llu bytes).\n",
+           (in_place ? dir : out_dir).c_str(), (unsigned long long)old_size,
+           (unsigned long long)new_size);
+  }
+  return 0;
+}
+
+int RecompressCommand::run(vector<string>& args) {
+  RecompressFlags flags;
+  while (parse_recompress_arg(args, flags)) {
+  }
+
+  string trace_dir;
+  if (!parse_optional_trace_dir(args, &trace_dir) || !args.empty()) {
+    print_help(stderr);
+    return 1;
+  }
+
+  return recompress(trace_dir, flags);
+}
+
+} // namespace rr
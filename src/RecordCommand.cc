@@ -32,6 +32,13 @@ RecordCommand RecordCommand::singleton(
     "  -c, --num-cpu-ticks=<NUM>  maximum number of 'CPU ticks' (currently \n"
     "                             retired conditional branches) to allow a \n"
     "                             task to run before interrupting it\n"
+    "  --compression-level=<N>    compress all trace data at Brotli quality\n"
+    "                             <N> (0-11). By default the level is chosen\n"
+    "                             per block, dropping to cheaper levels or\n"
+    "                             no compression when compression can't keep\n"
+    "                             up with the tracee\n"
+    "  --max-compression-level=<N> highest level to use when choosing the\n"
+    "                             level per block. Default 5\n"
     "  --disable-avx-512          Masks out the CPUID bits for AVX512\n"
     "                             This can improve trace portability\n"
     "  --disable-cpuid-features <CCC>[,<DDD>]\n"
@@ -89,6 +96,11 @@ RecordCommand RecordCommand::singleton(
     "                             Must not share memory with the outer.\n"
     "  --nested=release           Run the child without recording it.\n"
     "                             Must not share memory with the outer.\n"
+    "  --stream=<SOCKET|FD>       send the trace to `rr receive` listening on\n"
+    "                             Unix socket <SOCKET>, or write it to file\n"
+    "                             descriptor <FD>, while recording. Trace\n"
+    "                             data is kept locally only until it has\n"
+    "                             been sent\n"
     "  --setuid-sudo              If running under sudo, pretend to be the\n"
     "                             user that ran sudo rather than root. This\n"
     "                             allows recording setuid/setcap binaries.\n"
@@ -179,6 +191,13 @@ struct RecordFlags {
   /* True if we should always enable TSAN compatibility. */
   bool tsan;
 
+  /* Brotli quality for trace data, or CompressedWriter::ADAPTIVE_LEVEL */
+  int compression_level;
+  int max_compression_level;
+
+  /* If nonempty, where to stream the trace. See TraceWriter::stream_to. */
+  string stream;
+
   RecordFlags()
       : max_ticks(Scheduler::DEFAULT_MAX_TICKS),
         ignore_sig(0),
@@ -202,7 +221,9 @@ struct RecordFlags {
         stap_sdt(false),
         unmap_vdso(false),
         asan(false),
-        tsan(false) {}
+        tsan(false),
+        compression_level(CompressedWriter::ADAPTIVE_LEVEL),
+        max_compression_level(CompressedWriter::DEFAULT_LEVEL) {}
 };
 
 static void parse_signal_name(ParsedOption& opt) {
@@ -264,6 +285,9 @@ static bool parse_record_arg(vector<string>& args, RecordFlags& flags) {
     { 16, "disable-avx-512", NO_PARAMETER },
     { 17, "asan", NO_PARAMETER },
     { 18, "tsan", NO_PARAMETER },
+    { 19, "compression-level", HAS_PARAMETER },
+    { 20, "max-compression-level", HAS_PARAMETER },
+    { 21, "stream", HAS_PARAMETER },
     { 'c', "num-cpu-ticks", HAS_PARAMETER },
     { 'h', "chaos", NO_PARAMETER },
     { 'i', "ignore-signal", HAS_PARAMETER },
@@ -477,6 +501,21 @@ static bool parse_record_arg(vector<string>& args, RecordFlags& flags) {
     case 18:
       flags.tsan = true;
       break;
+    case 19:
+      if (!opt.verify_valid_int(0, CompressedWriter::MAX_LEVEL)) {
+        return false;
+      }
+      flags.compression_level = opt.int_value;
+      break;
+    case 20:
+      if (!opt.verify_valid_int(0, CompressedWriter::MAX_LEVEL)) {
+        return false;
+      }
+      flags.max_compression_level = opt.int_value;
+      break;
+    case 21:
+      flags.stream = opt.value;
+      break;
     case 's':
       flags.always_switch = true;
       break;
@@ -578,6 +617,11 @@ static void setup_session_from_flags(RecordSession& session,
   session.set_ignore_sig(flags.ignore_sig);
   session.set_continue_through_sig(flags.continue_through_sig);
   session.set_wait_for_all(flags.wait_for_all);
+  session.trace_writer().set_compression_level(flags.compression_level,
+                                               flags.max_compression_level);
+  if (!flags.stream.empty()) {
+    session.trace_writer().stream_to(flags.stream);
+  }
   if (flags.syscall_buffer_size > 0) {
     session.set_syscall_buffer_size(flags.syscall_buffer_size);
   }
@@ -684,8 +728,10 @@ static WaitStatus record(const vector<string>& args, const RecordFlags& flags) {
   do {
     bool done_initial_exec = session->done_initial_exec();
     step_result = session->record_step();
-    // Only create latest-trace symlink if --output-trace-dir is not being used
-    if (!done_initial_exec && session->done_initial_exec() && flags.output_trace_dir.empty()) {
+    // Only create latest-trace symlink if --output-trace-dir and --stream
+    // are not being used
+    if (!done_initial_exec && session->done_initial_exec() &&
+        flags.output_trace_dir.empty() && flags.stream.empty()) {
       session->trace_writer().make_latest_trace();
     }
     if (term_requested) {
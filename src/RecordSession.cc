@@ -16,6 +16,7 @@
 #include "AutoRemoteSyscalls.h"
 #include "ElfReader.h"
 #include "Flags.h"
+#include "PatchSiteCache.h"
 #include "RecordTask.h"
 #include "VirtualPerfCounterMonitor.h"
 #include "core.h"
@@ -1332,6 +1333,12 @@ void RecordSession::syscall_state_changed(RecordTask* t,
             }
             t->retry_syscall_patching = false;
           }
+          if (t->vm()->monkeypatcher().apply_cached_patches(t)) {
+            auto ev = Event::patch_syscall();
+            ev.PatchSyscall().patch_after_syscall = true;
+            t->record_event(ev);
+          }
+          t->maybe_resize_syscallbuf();
         }
       }
 
@@ -2501,8 +2508,11 @@ RecordSession::RecordResult RecordSession::record_step() {
       // We did do a context switch, so record the SCHED event. Otherwise
       // we'll just discard it.
       prev_task->record_current_event();
+      prev_task->pop_event(EV_SCHED);
+      prev_task->maybe_resize_syscallbuf();
+    } else {
+      prev_task->pop_event(EV_SCHED);
     }
-    prev_task->pop_event(EV_SCHED);
   }
   if (rescheduled.started_new_timeslice) {
     t->registers_at_start_of_last_timeslice = t->regs();
@@ -2637,6 +2647,9 @@ void RecordSession::term_detached_tasks() {
 
 void RecordSession::close_trace_writer(TraceWriter::CloseStatus status) {
   trace_out.close(status, trace_id.get());
+  if (status == TraceWriter::CLOSE_OK) {
+    PatchSiteCache::get().save();
+  }
 }
 
 Task* RecordSession::new_task(pid_t tid, pid_t, uint32_t serial,
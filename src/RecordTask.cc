@@ -6,6 +6,7 @@
 #include <elf.h>
 #include <limits.h>
 #include <linux/perf_event.h>
+#include <netinet/in.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 
@@ -181,6 +182,8 @@ RecordTask::RecordTask(RecordSession& session, pid_t _tid, uint32_t serial,
       flushed_syscallbuf(false),
       delay_syscallbuf_reset_for_desched(false),
       delay_syscallbuf_reset_for_seccomp_trap(false),
+      syscallbuf_full_flushes(0),
+      syscallbuf_idle_flushes(0),
       prctl_seccomp_status(0),
       robust_futex_list_len(0),
       termination_signal(0),
@@ -523,6 +526,7 @@ void RecordTask::on_syscall_exit_arch(int syscallno, const Registers& regs) {
   switch (syscallno) {
     // These syscalls affect the sigmask even if they fail.
     case Arch::epoll_pwait:
+    case Arch::epoll_pwait2:
     case Arch::pselect6:
     case Arch::pselect6_time64:
     case Arch::ppoll:
@@ -1593,7 +1597,8 @@ bool RecordTask::at_interrupted_non_restartable_signal_modifying_syscall() const
   auto r = regs();
   // XXXkhuey io_uring_enter (not yet supported) can do this too.
   return r.syscall_result_signed() == -EINTR &&
-    is_epoll_pwait_syscall(r.original_syscallno(), arch());
+    (is_epoll_pwait_syscall(r.original_syscallno(), arch()) ||
+     is_epoll_pwait2_syscall(r.original_syscallno(), arch()));
 }
 
 bool RecordTask::is_arm_desched_event_syscall() {
@@ -1683,8 +1688,30 @@ void RecordTask::record_remote(remote_ptr<void> addr, ssize_t num_bytes) {
     return;
   }
 
-  auto buf = read_mem(addr.cast<uint8_t>(), num_bytes);
-  trace_writer().write_raw(rec_tid, buf.data(), num_bytes, addr);
+  MemoryRange range(addr, num_bytes);
+  trace_writer().write_raw_ranges(rec_tid, &range, 1, [&](uint8_t* buf) {
+    read_bytes_helper(addr, num_bytes, buf);
+  });
+}
+
+void RecordTask::record_remote(const vector<MemoryRange>& ranges) {
+  maybe_flush_syscallbuf();
+
+  vector<MemoryRange> non_null;
+  for (auto& r : ranges) {
+    if (!r.start().is_null()) {
+      non_null.push_back(r);
+    }
+  }
+  trace_writer().write_raw_ranges(
+      rec_tid, non_null.data(), non_null.size(), [&](uint8_t* buf) {
+        vector<MemoryTransfer> transfers;
+        for (auto& r : non_null) {
+          transfers.push_back(MemoryTransfer(r.start(), r.size(), buf));
+          buf += r.size();
+        }
+        read_bytes_batched(transfers);
+      });
 }
 
 void RecordTask::record_remote_writable(remote_ptr<void> addr,
@@ -1768,8 +1795,10 @@ void RecordTask::record_remote_even_if_null(remote_ptr<void> addr,
     return;
   }
 
-  auto buf = read_mem(addr.cast<uint8_t>(), num_bytes);
-  trace_writer().write_raw(rec_tid, buf.data(), num_bytes, addr);
+  MemoryRange range(addr, num_bytes);
+  trace_writer().write_raw_ranges(rec_tid, &range, 1, [&](uint8_t* buf) {
+    read_bytes_helper(addr, num_bytes, buf);
+  });
 }
 
 void RecordTask::pop_event(EventType expected_type) {
@@ -1793,6 +1822,70 @@ void RecordTask::log_pending_events() const {
   }
 }
 
+/**
+ * Convert an address saved by a buffered syscall (see
+ * syscallbuf_socket_addrs) to the form read_proc_net_socket_addresses
+ * produces. Returns false if it isn't an IPv4 or IPv6 address.
+ */
+static bool convert_buffered_socket_addr(const uint8_t* addr, uint32_t len,
+                                         NativeArch::sockaddr_storage* out) {
+  memset(out, 0, sizeof(*out));
+  memcpy(out, addr, min<size_t>(len, sizeof(*out)));
+  auto sa = reinterpret_cast<struct sockaddr_storage*>(out);
+  // /proc/net gives us ports in host byte order.
+  switch (sa->ss_family) {
+    case AF_INET: {
+      auto sa_in = reinterpret_cast<struct sockaddr_in*>(sa);
+      sa_in->sin_port = ntohs(sa_in->sin_port);
+      return len >= sizeof(*sa_in);
+    }
+    case AF_INET6: {
+      auto sa_in6 = reinterpret_cast<struct sockaddr_in6*>(sa);
+      sa_in6->sin6_port = ntohs(sa_in6->sin6_port);
+      return len >= sizeof(*sa_in6);
+    }
+    default:
+      return false;
+  }
+}
+
+/**
+ * Collect the addresses of the connections made by the buffered accept,
+ * accept4 and connect syscalls in 'records'. Each one's addresses are in
+ * the getpeername record that follows it. Calls that were desched'ed aren't
+ * in the buffer; rec_process_syscall recorded their addresses already.
+ */
+static void get_buffered_socket_addrs(
+    SupportedArch arch, const uint8_t* records, size_t size,
+    vector<array<NativeArch::sockaddr_storage, 2>>* out) {
+  const uint8_t* end = records + size;
+  bool connected = false;
+  while (records < end) {
+    auto rec = reinterpret_cast<const struct syscallbuf_record*>(records);
+    if (rec->size < sizeof(*rec)) {
+      // The tracee corrupted its buffer; replay will complain.
+      return;
+    }
+    if (connected && is_getpeername_syscall(rec->syscallno, arch) &&
+        rec->size >= sizeof(*rec) + sizeof(syscallbuf_socket_addrs)) {
+      syscallbuf_socket_addrs addrs;
+      memcpy(&addrs, rec->extra_data, sizeof(addrs));
+      array<NativeArch::sockaddr_storage, 2> socket_addrs;
+      if (convert_buffered_socket_addr(addrs.local, addrs.local_len,
+                                       &socket_addrs[0]) &&
+          convert_buffered_socket_addr(addrs.remote, addrs.remote_len,
+                                       &socket_addrs[1])) {
+        out->push_back(socket_addrs);
+      }
+    }
+    connected =
+        ((is_accept_syscall(rec->syscallno, arch) ||
+          is_accept4_syscall(rec->syscallno, arch)) && rec->ret >= 0) ||
+        (is_connect_syscall(rec->syscallno, arch) && rec->ret == 0);
+    records += stored_record_size(rec->size);
+  }
+}
+
 void RecordTask::maybe_flush_syscallbuf() {
   if (EV_SYSCALLBUF_FLUSH == ev().type()) {
     // Already flushing.
@@ -1819,34 +1912,47 @@ void RecordTask::maybe_flush_syscallbuf() {
 
   push_event(Event(SyscallbufFlushEvent()));
 
-  // Apply buffered mprotect operations and flush the buffer in the tracee.
+  // Apply buffered mprotect/mmap/munmap operations and flush the buffer in
+  // the tracee.
   if (hdr.mprotect_record_count) {
     auto& records = ev().SyscallbufFlush().mprotect_records;
     records = read_mem(REMOTE_PTR_FIELD(preload_globals, mprotect_records[0]),
                        hdr.mprotect_record_count);
     for (auto& r : records) {
-      as->protect(this, r.start, r.size, r.prot);
+      as->apply_mprotect_record(this, r);
     }
   }
 
-  // Write the entire buffer in one shot without parsing it,
-  // because replay will take care of that.
-  if (is_running()) {
-    vector<uint8_t> buf;
-    buf.resize(sizeof(hdr) + hdr.num_rec_bytes);
-    memcpy(buf.data(), &hdr, sizeof(hdr));
+  // Write the entire buffer in one shot, because replay will take care of
+  // parsing it. We only look for the socket addresses of buffered
+  // connections. The records are read straight into the trace writer's
+  // buffer, so look at them before the writer gets to compact them.
+  MemoryRange range(syscallbuf_child, sizeof(hdr) + hdr.num_rec_bytes);
+  trace_writer().write_raw_ranges(rec_tid, &range, 1, [&](uint8_t* buf) {
+    memcpy(buf, &hdr, sizeof(hdr));
     read_bytes_helper(syscallbuf_child + 1, hdr.num_rec_bytes,
-                      buf.data() + sizeof(hdr));
-    record_local(syscallbuf_child, buf.size(), buf.data());
-  } else {
-    record_remote(syscallbuf_child, syscallbuf_data_size());
-  }
+                      buf + sizeof(hdr));
+    get_buffered_socket_addrs(arch(), buf + sizeof(hdr), hdr.num_rec_bytes,
+                              &ev().SyscallbufFlush().socket_addrs);
+  });
   record_current_event();
   pop_event(EV_SYSCALLBUF_FLUSH);
 
   flushed_syscallbuf = true;
   flushed_num_rec_bytes = hdr.num_rec_bytes;
 
+  size_t capacity = syscallbuf_size - sizeof(hdr);
+  if (hdr.num_rec_bytes >= capacity / 2) {
+    ++syscallbuf_full_flushes;
+    syscallbuf_idle_flushes = 0;
+  } else if (hdr.num_rec_bytes < capacity / 16) {
+    ++syscallbuf_idle_flushes;
+    syscallbuf_full_flushes = 0;
+  } else {
+    syscallbuf_full_flushes = 0;
+    syscallbuf_idle_flushes = 0;
+  }
+
   LOG(debug) << "Syscallbuf flushed with num_rec_bytes="
              << (uint32_t)hdr.num_rec_bytes;
 }
@@ -1867,6 +1973,66 @@ void RecordTask::maybe_reset_syscallbuf() {
   }
 }
 
+// Grow the syscallbuf after this many consecutive flushes of a buffer at
+// least half full, up to SYSCALLBUF_MAX_GROWTH times the session's size.
+// Shrink it after many more flushes of an almost empty buffer, down to
+// 1/SYSCALLBUF_MAX_SHRINK of the session's size.
+static const uint32_t SYSCALLBUF_GROW_FLUSHES = 8;
+static const uint32_t SYSCALLBUF_SHRINK_FLUSHES = 256;
+static const size_t SYSCALLBUF_MAX_GROWTH = 16;
+static const size_t SYSCALLBUF_MAX_SHRINK = 4;
+
+void RecordTask::maybe_resize_syscallbuf() {
+  if (!syscallbuf_child || flushed_syscallbuf ||
+      delay_syscallbuf_reset_for_desched ||
+      delay_syscallbuf_reset_for_seccomp_trap || ev().type() != EV_SENTINEL) {
+    return;
+  }
+
+  size_t session_size = session().syscall_buffer_size();
+  size_t max_size = session_size * SYSCALLBUF_MAX_GROWTH;
+  size_t min_size = ceil_page_size(session_size / SYSCALLBUF_MAX_SHRINK);
+  size_t new_size;
+  if (syscallbuf_full_flushes >= SYSCALLBUF_GROW_FLUSHES &&
+      syscallbuf_size < max_size) {
+    new_size = min(syscallbuf_size * 2, max_size);
+  } else if (syscallbuf_idle_flushes >= SYSCALLBUF_SHRINK_FLUSHES &&
+             syscallbuf_size > min_size) {
+    new_size = max(ceil_page_size(syscallbuf_size / 2), min_size);
+  } else {
+    return;
+  }
+  // The preload code may be holding pointers into the buffer.
+  if (is_in_syscallbuf() ||
+      read_mem(REMOTE_PTR_FIELD(syscallbuf_child, num_rec_bytes)) ||
+      read_mem(REMOTE_PTR_FIELD(syscallbuf_child, locked))) {
+    return;
+  }
+  syscallbuf_full_flushes = 0;
+  syscallbuf_idle_flushes = 0;
+
+  LOG(debug) << "Resizing syscallbuf from " << syscallbuf_size << " to "
+             << new_size;
+  KernelMapping km;
+  {
+    // A smaller buffer fits where the old one was.
+    remote_ptr<void> map_hint =
+        new_size < syscallbuf_size ? syscallbuf_child.cast<void>() : nullptr;
+    AutoRemoteSyscalls remote(this);
+    km = resize_syscall_buffer(remote, new_size, map_hint);
+  }
+  if (!km.size()) {
+    // The tracee died.
+    return;
+  }
+  auto record_in_trace = trace_writer().write_mapped_region(
+      this, km, km.fake_stat(), km.fsname(), vector<TraceRemoteFd>(),
+      TraceWriter::RR_BUFFER_MAPPING);
+  ASSERT(this, record_in_trace == TraceWriter::DONT_RECORD_IN_TRACE);
+  record_event(Event::syscallbuf_resize(), DONT_FLUSH_SYSCALLBUF,
+               DONT_RESET_SYSCALLBUF);
+}
+
 void RecordTask::record_event(const Event& ev, FlushSyscallbuf flush,
                               AllowSyscallbufReset reset,
                               const Registers* registers) {
@@ -401,6 +401,11 @@ public:
   void record_remote(const MemoryRange& range) {
     record_remote(range.start(), range.size());
   }
+  /**
+   * Like calling record_remote() on each range in turn, but reads them
+   * with read_bytes_batched().
+   */
+  void record_remote(const std::vector<MemoryRange>& ranges);
   ssize_t record_remote_fallible(const MemoryRange& range) {
     return record_remote_fallible(range.start(), range.size());
   }
@@ -476,6 +481,13 @@ public:
    * we run past any syscallbuf after-syscall code that uses the buffer data.
    */
   void maybe_reset_syscallbuf();
+  /**
+   * Call this when the task is stopped outside the syscallbuf code, after
+   * recording an event. If recent flushes found the syscallbuf mostly full
+   * (or mostly empty), replace it with a bigger (or smaller) one and record
+   * that for replay.
+   */
+  void maybe_resize_syscallbuf();
   /**
    * Record an event on behalf of this.  Record the registers of
    * this (and other relevant execution state) so that it can be
@@ -752,6 +764,10 @@ public:
    * record buffer from being reset when it normally would be.
    * This is set by the code for handling seccomp SIGSYS signals. */
   bool delay_syscallbuf_reset_for_seccomp_trap;
+  /* Number of consecutive flushes that found the syscallbuf at least half
+   * full, or almost empty. See maybe_resize_syscallbuf(). */
+  uint32_t syscallbuf_full_flushes;
+  uint32_t syscallbuf_idle_flushes;
   // Value to return from PR_GET_SECCOMP
   uint8_t prctl_seccomp_status;
 
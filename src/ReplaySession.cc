@@ -1297,17 +1297,26 @@ static uint32_t apply_mprotect_records(ReplayTask* t,
       auto& r = records[i];
       uint32_t completed_count = t->read_mem(REMOTE_PTR_FIELD(
           t->syscallbuf_child, mprotect_record_count_completed));
-      if (i >= completed_count) {
+      if (skip_mprotect_records + i >= completed_count) {
+        // mmap and munmap records are only published once they've
+        // completed, so this must be an mprotect.
+        DEBUG_ASSERT(r.kind == MPROTECT_RECORD_MPROTECT);
         auto km = t->vm()->read_kernel_mapping(t, r.start);
         if (km.prot() != r.prot) {
           // mprotect didn't happen yet.
           continue;
         }
       }
-      t->vm()->protect(t, r.start, r.size, r.prot);
+      t->vm()->apply_mprotect_record(t, r);
       if (running_under_rr()) {
-        syscall(SYS_rrcall_mprotect_record, t->tid, (uintptr_t)r.start,
-                (uintptr_t)r.size, r.prot);
+        if (r.kind == MPROTECT_RECORD_MPROTECT) {
+          syscall(SYS_rrcall_mprotect_record, t->tid, (uintptr_t)r.start,
+                  (uintptr_t)r.size, r.prot);
+        } else {
+          syscall(SYS_rrcall_mmap_record, t->tid, (uintptr_t)r.start,
+                  (uintptr_t)r.size,
+                  r.kind == MPROTECT_RECORD_MMAP ? r.prot : -1);
+        }
       }
     }
   }
@@ -1741,6 +1750,10 @@ ReplayTask* ReplaySession::setup_replay_one_trace_frame(ReplayTask* t) {
       t->reset_syscallbuf();
       current_step.action = TSTEP_RETIRE;
       break;
+    case EV_SYSCALLBUF_RESIZE:
+      t->resize_syscallbuf();
+      current_step.action = TSTEP_RETIRE;
+      break;
     case EV_PATCH_SYSCALL:
       if (ev.PatchSyscall().patch_trapping_instruction ||
           ev.PatchSyscall().patch_vsyscall) {
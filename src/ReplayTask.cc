@@ -63,6 +63,16 @@ void ReplayTask::init_buffers(remote_ptr<void> map_hint) {
   RR_ARCH_FUNCTION(init_buffers_arch, arch(), map_hint);
 }
 
+void ReplayTask::resize_syscallbuf() {
+  KernelMapping km = trace_reader().read_mapped_region();
+  ASSERT(this, km.size());
+  AutoRemoteSyscalls remote(this);
+  resize_syscall_buffer(remote, km.size(), km.start());
+  ASSERT(this, syscallbuf_child.cast<void>() == km.start())
+      << "Should have mapped syscallbuf at " << km.start() << ", but it's at "
+      << syscallbuf_child;
+}
+
 void ReplayTask::post_exec_syscall(const string& replay_exe, const string& original_replay_exe) {
   Task::post_exec(replay_exe, original_replay_exe);
 
@@ -135,16 +145,39 @@ ssize_t ReplayTask::set_data_from_trace() {
   return buf.data.size();
 }
 
+// Write a run of data records for the same task with one batched write.
+static void apply_data_records(ReplayTask* t,
+                               vector<TraceReader::RawData>& records) {
+  vector<Task::MemoryTransfer> transfers;
+  for (auto& r : records) {
+    transfers.push_back(Task::MemoryTransfer(r.addr, r.data.size(),
+                                             r.data.data()));
+  }
+  t->write_bytes_batched(transfers);
+  for (auto& r : records) {
+    t->vm()->maybe_update_breakpoints(t, r.addr.cast<uint8_t>(),
+                                      r.data.size());
+  }
+  records.clear();
+}
+
 void ReplayTask::apply_all_data_records_from_trace() {
+  vector<TraceReader::RawData> records;
+  ReplayTask* records_task = nullptr;
   TraceReader::RawData buf;
   while (trace_reader().read_raw_data_for_frame(buf)) {
     if (!buf.addr.is_null() && buf.data.size() > 0) {
       auto t = session().find_task(buf.rec_tid);
-      t->write_bytes_helper(buf.addr, buf.data.size(), buf.data.data());
-      t->vm()->maybe_update_breakpoints(t, buf.addr.cast<uint8_t>(),
-                                        buf.data.size());
+      if (t != records_task && !records.empty()) {
+        apply_data_records(records_task, records);
+      }
+      records_task = t;
+      records.push_back(std::move(buf));
     }
   }
+  if (!records.empty()) {
+    apply_data_records(records_task, records);
+  }
 }
 
 void ReplayTask::set_return_value_from_trace() {
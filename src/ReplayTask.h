@@ -30,6 +30,11 @@ public:
    * region; see |init_syscallbuf_buffer()|.
    */
   void init_buffers(remote_ptr<void> map_hint);
+  /**
+   * Replay an EV_SYSCALLBUF_RESIZE: replace the syscallbuf with the one
+   * described by the frame's mmap entry.
+   */
+  void resize_syscallbuf();
   /**
    * Call this method when the exec has completed.
    * `replay_exe` is the name of the real executable file in the trace if we have one,
@@ -97,7 +97,9 @@ Scheduler::Scheduler(RecordSession& session)
       enable_chaos(false),
       enable_poll(false),
       last_reschedule_in_high_priority_only_interval(false),
-      unlimited_ticks_mode(false) {
+      unlimited_ticks_mode(false),
+      status_changes_drained(false),
+      ntasks_running(0) {
   std::random_device rd;
   random.seed(rd());
   regenerate_affinity_mask();
@@ -233,6 +235,10 @@ bool Scheduler::is_task_runnable(RecordTask* t, bool* by_waitpid) {
     return true;
   }
 
+  // Rather than polling each blocked task, pick up all pending state
+  // changes at once. Tasks that stopped are then !is_running().
+  drain_status_changes();
+
   if (t->waiting_for_zombie) {
     LOG(debug) << "  " << t->tid << " is waiting to become a zombie";
     return false;
@@ -257,15 +263,20 @@ bool Scheduler::is_task_runnable(RecordTask* t, bool* by_waitpid) {
       // We have no way to detect a SIGCONT coming from outside the tracees.
       // We just have to poll SigPnd in /proc/<pid>/status.
       enable_poll = true;
-      // We also need to check if the task got killed.
-      t->try_wait();
+      // We also need to check if the task got killed. drain_status_changes()
+      // has already collected its PTRACE_EVENT_EXIT stop, if any.
+      t->wait_unexpected_exit();
       // N.B.: If we supported ptrace exit notifications for killed tracee's
       // that would need handling here, but we don't at the moment.
       return t->is_dying();
     }
   }
 
-  if (t->waiting_for_ptrace_exit) {
+  // drain_status_changes() may have collected the exit event of a task
+  // that's waiting for one. Any other status such a task has is stale.
+  bool has_exit_status = !t->is_running() &&
+                         t->status().ptrace_event() == PTRACE_EVENT_EXIT;
+  if (t->waiting_for_ptrace_exit && !has_exit_status) {
     LOG(debug) << "  " << t->tid << " is waiting to exit; checking status ...";
   } else if (!t->is_running()) {
     LOG(debug) << "  " << t->tid << "  was already stopped with status " << t->status();
@@ -301,7 +312,14 @@ bool Scheduler::is_task_runnable(RecordTask* t, bool* by_waitpid) {
   }
 
   bool did_wait_for_t;
-  did_wait_for_t = t->try_wait();
+  if (t->waiting_for_ptrace_exit) {
+    // The task may not have been running, so the drain can't be relied on.
+    did_wait_for_t = t->try_wait();
+  } else {
+    // Any stop of a running task was collected by drain_status_changes(),
+    // so only an unexpected exit can be left to report.
+    did_wait_for_t = t->wait_unexpected_exit();
+  }
   if (did_wait_for_t) {
     LOG(debug) << "  ready with status " << t->status();
     if (t->schedule_frozen && t->status().ptrace_event() != PTRACE_EVENT_SECCOMP) {
@@ -584,6 +602,41 @@ static RecordTask* find_waited_task(RecordSession& session, pid_t tid, WaitStatu
   return waited;
 }
 
+void Scheduler::drain_status_changes() {
+  if (status_changes_drained) {
+    return;
+  }
+  status_changes_drained = true;
+  while (ntasks_running > 0) {
+    // Only collect stops. Exit notifications are left for wait_any() and
+    // the reaping code, so we never reap a task here.
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int ret = waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG | __WALL);
+    if (ret < 0) {
+      if (errno == ECHILD || errno == EINTR) {
+        return;
+      }
+      FATAL() << "Failed to waitid()";
+    }
+    if (info.si_pid == 0) {
+      return;
+    }
+    WaitStatus status(info);
+    LOG(debug) << "  " << info.si_pid << " changed status to " << status;
+    RecordTask* waited = find_waited_task(session, info.si_pid, status);
+    if (!waited) {
+      continue;
+    }
+    // A task we haven't resumed (e.g. a new clone child's initial stop) was
+    // never counted as running.
+    if (waited->is_running()) {
+      ntasks_running--;
+    }
+    waited->did_waitpid(status);
+  }
+}
+
 bool Scheduler::may_use_unlimited_ticks() {
   return ntasks_running == session.tasks().size() - 1;
 }
@@ -675,6 +728,8 @@ Scheduler::Rescheduled Scheduler::reschedule(Switchable switchable) {
   RecordTask* next = nullptr;
   // While a threadgroup is in execve, treat all tasks as blocked.
   while (!in_exec_tgid) {
+    // Tasks may have stopped since the last iteration.
+    status_changes_drained = false;
     maybe_reset_high_priority_only_intervals(now);
     last_reschedule_in_high_priority_only_interval =
         in_high_priority_only_interval(now);
@@ -213,6 +213,13 @@ private:
   bool in_high_priority_only_interval(double now);
   bool treat_as_high_priority(RecordTask* t);
   bool is_task_runnable(RecordTask* t, bool* by_waitpid);
+  /**
+   * Collect every pending stop of our running tracees with non-blocking
+   * waitid(P_ALL) calls, so is_task_runnable doesn't have to poll each
+   * blocked task separately. Does nothing if it already ran since
+   * status_changes_drained was last cleared, or if no task is running.
+   */
+  void drain_status_changes();
   void validate_scheduled_task();
   void regenerate_affinity_mask();
 
@@ -279,6 +286,7 @@ private:
   bool last_reschedule_in_high_priority_only_interval;
 
   bool unlimited_ticks_mode;
+  bool status_changes_drained;
   size_t ntasks_running;
 };
 
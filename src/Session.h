@@ -394,6 +394,9 @@ public:
   int syscall_number_for_rrcall_rdtsc() const {
     return SYS_rrcall_rdtsc - RR_CALL_BASE + rrcall_base_;
   }
+  int syscall_number_for_rrcall_mmap_record() const {
+    return SYS_rrcall_mmap_record - RR_CALL_BASE + rrcall_base_;
+  }
 
   /* Bind the current process to the a CPU as specified in the session options
      or trace */
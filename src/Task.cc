@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/user.h>
 #include <sys/wait.h>
@@ -558,6 +559,19 @@ void Task::on_syscall_exit_arch(int syscallno, const Registers& regs) {
     ASSERT(this, t);
     return t->vm()->protect(t, addr, num_bytes, prot);
   }
+  if (syscallno == session_->syscall_number_for_rrcall_mmap_record()) {
+    // Same as above, for syscallbuf'ed private anonymous `mmap` and
+    // `munmap`.
+    pid_t tid = regs.orig_arg1();
+    mprotect_record r;
+    r.start = regs.arg2();
+    r.size = regs.arg3();
+    r.prot = regs.arg4_signed();
+    r.kind = r.prot == -1 ? MPROTECT_RECORD_MUNMAP : MPROTECT_RECORD_MMAP;
+    Task* t = session().find_task(tid);
+    ASSERT(this, t);
+    return t->vm()->apply_mprotect_record(t, r);
+  }
 
   // mprotect can change the protection status of some mapped regions before
   // failing.
@@ -2432,6 +2446,7 @@ bool Task::post_vm_clone(CloneReason reason, int flags, Task* origin) {
     created_preload_thread_locals_mapping = this->as->post_vm_clone(this);
   }
   this->as->fd_tables_changed();
+  this->as->task_set_changed();
 
   if (reason == TRACEE_CLONE) {
     setup_preload_thread_locals_from_clone(origin);
@@ -2754,6 +2769,43 @@ KernelMapping Task::init_syscall_buffer(AutoRemoteSyscalls& remote,
   return km;
 }
 
+template <typename Arch>
+static void set_preload_thread_locals_buffer_arch(Task* t) {
+  void* local_addr = preload_thread_locals_local_addr(*t->vm());
+  if (local_addr) {
+    auto locals = reinterpret_cast<preload_thread_locals<Arch>*>(local_addr);
+    locals->buffer = t->syscallbuf_child.cast<uint8_t>();
+    locals->buffer_size = t->syscallbuf_size;
+  }
+}
+
+static void set_preload_thread_locals_buffer(Task* t) {
+  RR_ARCH_FUNCTION(set_preload_thread_locals_buffer_arch, t->arch(), t);
+}
+
+KernelMapping Task::resize_syscall_buffer(AutoRemoteSyscalls& remote,
+                                          size_t size,
+                                          remote_ptr<void> map_hint) {
+  struct syscallbuf_hdr hdr = read_mem(syscallbuf_child);
+  ASSERT(this, !hdr.num_rec_bytes) << "Resizing a non-empty syscallbuf";
+
+  remote.infallible_syscall(syscall_number_for_munmap(arch()),
+                            syscallbuf_child, syscallbuf_size);
+  vm()->unmap(this, syscallbuf_child, syscallbuf_size);
+  syscallbuf_child = nullptr;
+  syscallbuf_size = size;
+  KernelMapping km = init_syscall_buffer(remote, map_hint);
+  if (!km.size()) {
+    return km;
+  }
+  // The header holds state shared with the preload library (e.g. the
+  // blocked signal mask), so carry it over.
+  write_mem(syscallbuf_child, hdr);
+  activate_preload_thread_locals();
+  set_preload_thread_locals_buffer(this);
+  return km;
+}
+
 void Task::set_syscallbuf_locked(bool locked) {
   if (!syscallbuf_child) {
     return;
@@ -3031,6 +3083,124 @@ ssize_t Task::write_bytes_helper_no_notifications(remote_ptr<void> addr, ssize_t
   return nwritten;
 }
 
+// Set when process_vm_readv/writev fail in a way that means they'll never
+// work for us (e.g. they're blocked by a sandbox), so we stop trying them.
+static bool process_vm_rw_unavailable = false;
+
+/**
+ * Transfer as many of the |count| transfers starting at |transfers| as
+ * possible with one process_vm_readv/writev. Returns the number of transfers
+ * completed; |*partial| is set to the number of bytes of the next transfer
+ * that were done before the kernel stopped.
+ */
+static size_t process_vm_rw(pid_t tid, const Task::MemoryTransfer* transfers,
+                            size_t count, bool write, size_t* partial) {
+  static const size_t max_iovs = 1024;
+  struct iovec local[max_iovs];
+  struct iovec remote[max_iovs];
+  count = min(count, max_iovs);
+  for (size_t i = 0; i < count; ++i) {
+    local[i].iov_base = transfers[i].buf;
+    local[i].iov_len = transfers[i].size;
+    remote[i].iov_base = (void*)transfers[i].addr.as_int();
+    remote[i].iov_len = transfers[i].size;
+  }
+
+  *partial = 0;
+  ssize_t ret = write ? process_vm_writev(tid, local, count, remote, count, 0)
+                      : process_vm_readv(tid, local, count, remote, count, 0);
+  if (ret < 0) {
+    if (errno == ENOSYS || errno == EPERM) {
+      LOG(debug) << "process_vm_" << (write ? "writev" : "readv")
+                 << " unavailable; using /proc/<tid>/mem";
+      process_vm_rw_unavailable = true;
+    }
+    return 0;
+  }
+  size_t done = 0;
+  while (done < count && (size_t)ret >= transfers[done].size) {
+    ret -= transfers[done].size;
+    ++done;
+  }
+  if (done < count) {
+    *partial = ret;
+  }
+  return done;
+}
+
+// Drop empty transfers and satisfy the ones our local mappings cover,
+// returning the ones that need to go to the kernel.
+static vector<Task::MemoryTransfer> transfers_needing_syscalls(
+    AddressSpace* as, const vector<Task::MemoryTransfer>& transfers,
+    bool write) {
+  vector<Task::MemoryTransfer> result;
+  for (auto& tr : transfers) {
+    if (!tr.size) {
+      continue;
+    }
+    if (uint8_t* local_addr = as->local_mapping(tr.addr, tr.size)) {
+      if (write) {
+        memcpy(local_addr, tr.buf, tr.size);
+      } else {
+        memcpy(tr.buf, local_addr, tr.size);
+      }
+      continue;
+    }
+    result.push_back(tr);
+  }
+  return result;
+}
+
+void Task::read_bytes_batched(const vector<MemoryTransfer>& transfers,
+                              bool* ok) {
+  vector<MemoryTransfer> pending =
+      transfers_needing_syscalls(as.get(), transfers, false);
+  size_t i = 0;
+  while (i < pending.size()) {
+    size_t partial = 0;
+    if (!process_vm_rw_unavailable) {
+      i += process_vm_rw(tid, pending.data() + i, pending.size() - i, false,
+                         &partial);
+      if (i == pending.size()) {
+        break;
+      }
+    }
+    auto& tr = pending[i];
+    read_bytes_helper(tr.addr + partial, tr.size - partial,
+                      static_cast<uint8_t*>(tr.buf) + partial, ok);
+    ++i;
+  }
+}
+
+void Task::write_bytes_batched(const vector<MemoryTransfer>& transfers,
+                               bool* ok, uint32_t flags) {
+  vector<MemoryTransfer> pending =
+      transfers_needing_syscalls(as.get(), transfers, true);
+  size_t i = 0;
+  while (i < pending.size()) {
+    size_t partial = 0;
+    if (!process_vm_rw_unavailable) {
+      size_t done = process_vm_rw(tid, pending.data() + i, pending.size() - i,
+                                  true, &partial);
+      for (size_t j = i; j < i + done; ++j) {
+        vm()->notify_written(pending[j].addr, pending[j].size, flags);
+      }
+      i += done;
+      if (i == pending.size()) {
+        break;
+      }
+      if (partial) {
+        vm()->notify_written(pending[i].addr, partial, flags);
+      }
+    }
+    auto& tr = pending[i];
+    write_bytes_helper(tr.addr + partial, tr.size - partial,
+                       static_cast<const uint8_t*>(tr.buf) + partial, ok,
+                       flags);
+    ++i;
+  }
+}
+
 uint64_t Task::write_ranges(const vector<FileMonitor::Range>& ranges,
                             void* data, size_t size) {
   uint8_t* p = static_cast<uint8_t*>(data);
@@ -752,6 +752,28 @@ public:
    */
   void write_zeroes(std::unique_ptr<AutoRemoteSyscalls>* remote, remote_ptr<void> addr, size_t size);
 
+  /**
+   * A range of tracee memory and the local buffer it's read into or
+   * written from.
+   */
+  struct MemoryTransfer {
+    MemoryTransfer(remote_ptr<void> addr, size_t size, void* buf)
+        : addr(addr), size(size), buf(buf) {}
+    remote_ptr<void> addr;
+    size_t size;
+    void* buf;
+  };
+  /**
+   * Like calling read_bytes_helper()/write_bytes_helper() on each transfer
+   * in order, but uses a single process_vm_readv/process_vm_writev for as
+   * many of them as it can. Ranges those can't access (e.g. PROT_NONE or
+   * read-only pages) fall back to /proc/<tid>/mem.
+   */
+  void read_bytes_batched(const std::vector<MemoryTransfer>& transfers,
+                          bool* ok = nullptr);
+  void write_bytes_batched(const std::vector<MemoryTransfer>& transfers,
+                           bool* ok = nullptr, uint32_t flags = 0);
+
   /**
    * Don't use these helpers directly; use the safer and more
    * convenient variants above.
@@ -1152,6 +1174,14 @@ protected:
   KernelMapping init_syscall_buffer(AutoRemoteSyscalls& remote,
                                     remote_ptr<void> map_hint);
 
+  /**
+   * Replace the syscallbuf, which must be empty, with one of |size| bytes,
+   * keeping its header. |map_hint| is as for init_syscall_buffer(). Updates
+   * syscallbuf_child and the preload thread-locals.
+   */
+  KernelMapping resize_syscall_buffer(AutoRemoteSyscalls& remote, size_t size,
+                                      remote_ptr<void> map_hint);
+
   /**
    * Make the OS-level calls to create a new fork or clone that
    * will eventually be a copy of this task and return that Task
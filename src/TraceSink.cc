@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "TraceSink.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <vector>
+
+#include "log.h"
+#include "util.h"
+
+using namespace std;
+
+namespace rr {
+
+const char TraceSink::MAGIC[8] = { 'R', 'R', 'S', 'T', 'R', 'E', 'A', 'M' };
+
+static ScopedFd open_stream(const string& spec) {
+  char* end;
+  long n = strtol(spec.c_str(), &end, 10);
+  if (!spec.empty() && !*end) {
+    // The tracees must not share the stream, so move it to a
+    // close-on-exec fd.
+    if (n <= STDERR_FILENO) {
+      CLEAN_FATAL() << "Can't stream the trace to stdin/stdout/stderr";
+    }
+    ScopedFd fd(fcntl(n, F_DUPFD_CLOEXEC, 0));
+    if (!fd.is_open()) {
+      CLEAN_FATAL() << "Can't stream the trace to fd " << n;
+    }
+    close(n);
+    return fd;
+  }
+
+  ScopedFd sock = ScopedFd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!sock.is_open()) {
+    FATAL() << "Can't create Unix socket";
+  }
+  if (spec.size() + 1 > sizeof(sockaddr_un::sun_path)) {
+    CLEAN_FATAL() << "Socket file name " << spec << " too long";
+  }
+  sockaddr_un addr;
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, spec.c_str());
+  if (connect(sock, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+    CLEAN_FATAL() << "Can't connect to " << spec
+                  << "; is `rr receive` listening there?";
+  }
+  return sock;
+}
+
+TraceSink::TraceSink(const string& spec, const string& trace_name)
+    : fd(open_stream(spec)) {
+  pthread_mutex_init(&mutex, nullptr);
+  StreamHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = STREAM_VERSION;
+  header.name_length = trace_name.size();
+  send(&header, sizeof(header));
+  send(trace_name.c_str(), trace_name.size());
+}
+
+TraceSink::~TraceSink() { pthread_mutex_destroy(&mutex); }
+
+void TraceSink::send(const void* data, size_t size) {
+  const char* buf = static_cast<const char*>(data);
+  while (size > 0) {
+    // Don't die of SIGPIPE if the receiver goes away; report it instead.
+    ssize_t ret = ::send(fd, buf, size, MSG_NOSIGNAL);
+    if (ret < 0 && errno == ENOTSOCK) {
+      ret = ::write(fd, buf, size);
+    }
+    if (ret <= 0) {
+      FATAL() << "Can't write " << size << " bytes to the trace stream";
+    }
+    buf += ret;
+    size -= ret;
+  }
+}
+
+void TraceSink::write(const string& file_name, uint64_t offset,
+                      const void* data, size_t size) {
+  RecordHeader header;
+  header.kind = RECORD_WRITE;
+  header.name_length = file_name.size();
+  header.offset = offset;
+  header.data_length = size;
+  pthread_mutex_lock(&mutex);
+  send(&header, sizeof(header));
+  send(file_name.c_str(), file_name.size());
+  send(data, size);
+  pthread_mutex_unlock(&mutex);
+}
+
+void TraceSink::write_file(const string& path, const string& file_name) {
+  ScopedFd file(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (!file.is_open()) {
+    FATAL() << "Can't open " << path;
+  }
+  vector<uint8_t> buf(1024 * 1024);
+  uint64_t offset = 0;
+  // Always send at least one record so empty files are created too.
+  do {
+    ssize_t ret = read_to_end(file, offset, buf.data(), buf.size());
+    if (ret < 0) {
+      FATAL() << "Can't read " << path;
+    }
+    write(file_name, offset, buf.data(), ret);
+    if ((size_t)ret < buf.size()) {
+      break;
+    }
+    offset += ret;
+  } while (true);
+}
+
+void TraceSink::end() {
+  RecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.kind = RECORD_END;
+  pthread_mutex_lock(&mutex);
+  send(&header, sizeof(header));
+  pthread_mutex_unlock(&mutex);
+  fd.close();
+}
+
+} // namespace rr
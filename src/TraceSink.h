@@ -0,0 +1,71 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#ifndef RR_TRACE_SINK_H_
+#define RR_TRACE_SINK_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "ScopedFd.h"
+
+namespace rr {
+
+/**
+ * TraceSink sends the files of a trace directory over a single stream
+ * (a pipe, or a connection to a Unix socket) while the trace is being
+ * recorded. `rr receive` rebuilds the trace directory from the stream.
+ *
+ * The stream starts with a StreamHeader followed by the trace name. Then
+ * there is a sequence of records, each a RecordHeader followed by the file
+ * name (relative to the trace directory) and the data. The data of a
+ * RECORD_WRITE is written at 'offset' in the file, creating the file if
+ * necessary; writes to a file may arrive in any order. RECORD_END marks
+ * a complete trace. Nothing is sent after it.
+ *
+ * Any thread may call write(); records are never interleaved.
+ */
+class TraceSink {
+public:
+  enum { STREAM_VERSION = 1 };
+  struct StreamHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t name_length;
+  };
+  static const char MAGIC[8];
+
+  enum RecordKind { RECORD_WRITE = 0, RECORD_END = 1 };
+  struct RecordHeader {
+    uint32_t kind;
+    uint32_t name_length;
+    uint64_t offset;
+    uint64_t data_length;
+  };
+
+  /**
+   * 'spec' is a file descriptor number or the path of a listening Unix
+   * socket. Fatal if the stream can't be opened.
+   */
+  TraceSink(const std::string& spec, const std::string& trace_name);
+  ~TraceSink();
+
+  void write(const std::string& file_name, uint64_t offset, const void* data,
+             size_t size);
+  /**
+   * Send the contents of the file at 'path' as 'file_name'.
+   */
+  void write_file(const std::string& path, const std::string& file_name);
+  void end();
+
+private:
+  void send(const void* data, size_t size);
+
+  ScopedFd fd;
+  pthread_mutex_t mutex;
+};
+
+} // namespace rr
+
+#endif /* RR_TRACE_SINK_H_ */
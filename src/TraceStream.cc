@@ -20,6 +20,7 @@
 #include "AddressSpace.h"
 #include "AutoRemoteSyscalls.h"
 #include "Event.h"
+#include "Flags.h"
 #include "RecordSession.h"
 #include "RecordTask.h"
 #include "TaskishUid.h"
@@ -30,6 +31,8 @@
 #include "rr_trace.capnp.h"
 #include "util.h"
 
+#include "../third-party/blake2/blake2.h"
+
 #include "rr/rr.h"
 
 using namespace std;
@@ -51,13 +54,15 @@ struct SubstreamData {
   const char* name;
   size_t block_size;
   int threads;
+  // Number of blocks to decompress ahead when reading, by default.
+  size_t decompress_ahead;
 };
 
 static SubstreamData substreams[TraceStream::SUBSTREAM_COUNT] = {
-  { "events", 1024 * 1024, 1 },
-  { "data", 1024 * 1024, 0 },
-  { "mmaps", 64 * 1024, 1 },
-  { "tasks", 64 * 1024, 1 },
+  { "events", 1024 * 1024, 1, 2 },
+  { "data", 1024 * 1024, 0, 4 },
+  { "mmaps", 64 * 1024, 1, 0 },
+  { "tasks", 64 * 1024, 1, 0 },
 };
 
 static const SubstreamData& substream(TraceStream::Substream s) {
@@ -67,6 +72,15 @@ static const SubstreamData& substream(TraceStream::Substream s) {
   return substreams[s];
 }
 
+static size_t decompress_ahead(TraceStream::Substream s) {
+  int blocks = Flags::get().decompress_ahead;
+  if (blocks == Flags::DECOMPRESS_AHEAD_DEFAULT) {
+    return substream(s).decompress_ahead;
+  }
+  // Small substreams aren't worth a thread.
+  return substream(s).decompress_ahead ? blocks : 0;
+}
+
 static TraceStream::Substream operator++(TraceStream::Substream& s) {
   s = (TraceStream::Substream)(s + 1);
   return s;
@@ -206,6 +220,14 @@ string TraceStream::path(Substream s) {
 
 size_t TraceStream::mmaps_block_size() { return substreams[MMAPS].block_size; }
 
+const char* TraceStream::substream_file_name(Substream s) {
+  return substream(s).name;
+}
+
+size_t TraceStream::substream_block_size(Substream s) {
+  return substream(s).block_size;
+}
+
 bool TraceWriter::good() const {
   for (auto& w : writers) {
     if (!w->good()) {
@@ -395,6 +417,11 @@ static int check_fd(int fd) {
 // 8-byte words
 static const size_t reasonable_frame_message_words = 64;
 
+// Frame registers are delta-encoded in slots of this many bytes. There are
+// at most 64 slots so the changed ones fit in a UInt64 bitmask.
+static const size_t register_slot_size = 8;
+static const size_t max_register_slots = 64;
+
 void TraceWriter::write_frame(RecordTask* t, const Event& ev,
                               const Registers* registers,
                               const ExtraRegisters* extra_registers) {
@@ -421,17 +448,54 @@ void TraceWriter::write_frame(RecordTask* t, const Event& ev,
       holes[j].setOffset(r.holes[j].offset);
       holes[j].setSize(r.holes[j].size);
     }
+    if (r.dedup_offset != NOT_DEDUPLICATED) {
+      w.setDedup(true);
+      w.setDedupOffset(r.dedup_offset);
+    }
   }
   raw_recs.clear();
   frame.setArch(to_trace_arch(t->arch()));
   if (registers) {
     // Avoid dynamic allocation and copy
     auto raw_regs = registers->get_regs_for_trace();
-    frame.initRegisters().setRaw(Data::Reader(raw_regs.data, raw_regs.size));
+    auto regs = frame.initRegisters();
+    FrameRegisters& last = last_frame_registers[t->tid];
+    if (last.arch == registers->arch() && last.raw.size() == raw_regs.size &&
+        raw_regs.size <= register_slot_size * max_register_slots) {
+      uint64_t changed_slots = 0;
+      uint8_t changed_values[register_slot_size * max_register_slots];
+      size_t changed_size = 0;
+      for (size_t offset = 0; offset < raw_regs.size;
+           offset += register_slot_size) {
+        size_t len = min(register_slot_size, raw_regs.size - offset);
+        if (memcmp(&last.raw[offset], raw_regs.data + offset, len)) {
+          changed_slots |= uint64_t(1) << (offset / register_slot_size);
+          memcpy(changed_values + changed_size, raw_regs.data + offset, len);
+          changed_size += len;
+        }
+      }
+      regs.setDelta(true);
+      regs.setChangedSlots(changed_slots);
+      regs.setChangedValues(Data::Reader(changed_values, changed_size));
+      memcpy(last.raw.data(), raw_regs.data, raw_regs.size);
+    } else {
+      regs.setRaw(Data::Reader(raw_regs.data, raw_regs.size));
+      last.arch = registers->arch();
+      last.raw.assign(raw_regs.data, raw_regs.data + raw_regs.size);
+    }
   }
   if (extra_registers) {
-    frame.initExtraRegisters().setRaw(Data::Reader(
-        extra_registers->data_bytes(), extra_registers->data_size()));
+    auto extra_regs = frame.initExtraRegisters();
+    if (extra_registers->has_xsave_header()) {
+      // Mostly init-state components on AVX-512 machines; don't store them.
+      vector<uint8_t> data =
+          extra_registers->get_xsave_without_init_components();
+      extra_regs.setRaw(Data::Reader(data.data(), data.size()));
+      extra_regs.setXsaveInitComponentsElided(true);
+    } else {
+      extra_regs.setRaw(Data::Reader(extra_registers->data_bytes(),
+                                     extra_registers->data_size()));
+    }
   }
 
   auto event = frame.initEvent();
@@ -456,6 +520,9 @@ void TraceWriter::write_frame(RecordTask* t, const Event& ev,
     case EV_SYSCALLBUF_RESET:
       event.setSyscallbufReset(Void());
       break;
+    case EV_SYSCALLBUF_RESIZE:
+      event.setSyscallbufResize(Void());
+      break;
     case EV_SCHED:
       frame.setInSyscallbufSyscallHook(ev.Sched().in_syscallbuf_syscall_hook.register_value());
       event.setSched(Void());
@@ -477,9 +544,21 @@ void TraceWriter::write_frame(RecordTask* t, const Event& ev,
       break;
     case EV_SYSCALLBUF_FLUSH: {
       const SyscallbufFlushEvent& e = ev.SyscallbufFlush();
-      event.initSyscallbufFlush().setMprotectRecords(Data::Reader(
+      auto flush = event.initSyscallbufFlush();
+      flush.setMprotectRecords(Data::Reader(
           reinterpret_cast<const uint8_t*>(e.mprotect_records.data()),
           e.mprotect_records.size() * sizeof(mprotect_record)));
+      if (!e.socket_addrs.empty()) {
+        auto addrs = flush.initSocketAddrs(e.socket_addrs.size());
+        for (size_t i = 0; i < e.socket_addrs.size(); ++i) {
+          addrs[i].setLocalAddr(Data::Reader(
+              reinterpret_cast<const uint8_t*>(&e.socket_addrs[i][0]),
+              sizeof(e.socket_addrs[i][0])));
+          addrs[i].setRemoteAddr(Data::Reader(
+              reinterpret_cast<const uint8_t*>(&e.socket_addrs[i][1]),
+              sizeof(e.socket_addrs[i][1])));
+        }
+      }
       break;
     }
     case EV_SYSCALL: {
@@ -530,6 +609,32 @@ void TraceWriter::write_frame(RecordTask* t, const Event& ev,
   }
 
   tick_time();
+  index_frame_position();
+}
+
+// Besides indexing the first frame in each events block, index at least
+// every this many frames.
+static const FrameTime frame_index_interval = 4096;
+
+void TraceWriter::index_frame_position() {
+  size_t events_block_size = substream(EVENTS).block_size;
+  uint64_t events_offset = writer(EVENTS).bytes_written();
+  if (!frame_positions.empty()) {
+    const FramePosition& last = frame_positions.back();
+    if (last.offsets[EVENTS] / events_block_size ==
+            events_offset / events_block_size &&
+        global_time - last.time < frame_index_interval) {
+      return;
+    }
+  }
+  FramePosition pos;
+  pos.time = global_time;
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    pos.offsets[s] = writer(s).bytes_written();
+  }
+  frame_positions.push_back(pos);
+  // Readers that seek here won't know the earlier registers.
+  last_frame_registers.clear();
 }
 
 TraceFrame TraceReader::read_frame() {
@@ -553,7 +658,15 @@ TraceFrame TraceReader::read_frame() {
       const auto& hole = holes[j];
       h[j] = { hole.getOffset(), hole.getSize() };
     }
-    raw_recs[i] = { w.getAddr(), (size_t)w.getSize(), i32_to_tid(w.getTid()), h };
+    uint64_t dedup_offset = NOT_DEDUPLICATED;
+    if (w.getDedup()) {
+      dedup_offset = w.getDedupOffset();
+      if (!h.empty()) {
+        FATAL() << "Invalid deduplicated raw data record";
+      }
+    }
+    raw_recs[i] = { w.getAddr(), (size_t)w.getSize(), i32_to_tid(w.getTid()),
+                    h, dedup_offset };
   }
 
   TraceFrame ret;
@@ -567,13 +680,50 @@ TraceFrame TraceReader::read_frame() {
 
   SupportedArch arch = from_trace_arch(frame.getArch());
   ret.recorded_regs.set_arch(arch);
-  auto reg_data = frame.getRegisters().getRaw();
-  if (reg_data.size()) {
-    ret.recorded_regs.set_from_trace(arch, reg_data.begin(),
-                                     reg_data.size());
+  auto regs = frame.getRegisters();
+  if (regs.getDelta()) {
+    // Applying a delta a second time (e.g. after peek_frame) gives the
+    // same result, so we don't need to undo this when peeking.
+    auto it = last_frame_registers.find(ret.tid_);
+    if (it == last_frame_registers.end() || it->second.arch != arch) {
+      FATAL() << "Register delta without earlier registers";
+    }
+    vector<uint8_t>& raw = it->second.raw;
+    uint64_t changed_slots = regs.getChangedSlots();
+    auto values = regs.getChangedValues();
+    size_t values_offset = 0;
+    for (size_t offset = 0; offset < raw.size(); offset += register_slot_size) {
+      if (!(changed_slots & (uint64_t(1) << (offset / register_slot_size)))) {
+        continue;
+      }
+      size_t len = min(register_slot_size, raw.size() - offset);
+      if (values_offset + len > values.size()) {
+        FATAL() << "Invalid register delta";
+      }
+      memcpy(&raw[offset], values.begin() + values_offset, len);
+      values_offset += len;
+    }
+    ret.recorded_regs.set_from_trace(arch, raw.data(), raw.size());
+  } else {
+    auto reg_data = regs.getRaw();
+    if (reg_data.size()) {
+      ret.recorded_regs.set_from_trace(arch, reg_data.begin(),
+                                       reg_data.size());
+      FrameRegisters& last = last_frame_registers[ret.tid_];
+      last.arch = arch;
+      last.raw.assign(reg_data.begin(), reg_data.end());
+    }
   }
-  auto extra_reg_data = frame.getExtraRegisters().getRaw();
-  if (extra_reg_data.size()) {
+  auto extra_regs = frame.getExtraRegisters();
+  auto extra_reg_data = extra_regs.getRaw();
+  if (extra_regs.getXsaveInitComponentsElided()) {
+    if (!is_x86ish(arch) ||
+        !ret.recorded_extra_regs.set_to_xsave_without_init_components(
+            arch, extra_reg_data.begin(), extra_reg_data.size(),
+            xsave_layout_from_trace(cpuid_records()))) {
+      FATAL() << "Invalid extended register data in trace";
+    }
+  } else if (extra_reg_data.size()) {
     ExtraRegisters::Format fmt;
     switch (arch) {
       default:
@@ -623,6 +773,9 @@ TraceFrame TraceReader::read_frame() {
     case trace::Frame::Event::SYSCALLBUF_RESET:
       ret.ev = Event::syscallbuf_reset();
       break;
+    case trace::Frame::Event::SYSCALLBUF_RESIZE:
+      ret.ev = Event::syscallbuf_resize();
+      break;
     case trace::Frame::Event::SCHED:
       ret.ev = Event::sched();
       ret.ev.Sched().in_syscallbuf_syscall_hook = frame.getInSyscallbufSyscallHook();
@@ -644,11 +797,25 @@ TraceFrame TraceReader::read_frame() {
       break;
     case trace::Frame::Event::SYSCALLBUF_FLUSH: {
       ret.ev = Event(SyscallbufFlushEvent());
-      auto mprotect_records = event.getSyscallbufFlush().getMprotectRecords();
+      auto flush = event.getSyscallbufFlush();
+      auto mprotect_records = flush.getMprotectRecords();
       auto& records = ret.ev.SyscallbufFlush().mprotect_records;
       records.resize(mprotect_records.size() / sizeof(mprotect_record));
       memcpy(records.data(), mprotect_records.begin(),
              records.size() * sizeof(mprotect_record));
+      auto addrs = flush.getSocketAddrs();
+      auto& socket_addrs = ret.ev.SyscallbufFlush().socket_addrs;
+      socket_addrs.resize(addrs.size());
+      for (size_t i = 0; i < addrs.size(); ++i) {
+        Data::Reader local = addrs[i].getLocalAddr();
+        Data::Reader remote = addrs[i].getRemoteAddr();
+        if (local.size() != sizeof(NativeArch::sockaddr_storage) ||
+            remote.size() != sizeof(NativeArch::sockaddr_storage)) {
+          FATAL() << "Invalid sockaddr length";
+        }
+        memcpy(&socket_addrs[i][0], local.begin(), local.size());
+        memcpy(&socket_addrs[i][1], remote.begin(), remote.size());
+      }
       break;
     }
     case trace::Frame::Event::SYSCALL: {
@@ -1196,10 +1363,191 @@ KernelMapping TraceReader::read_mapped_region(MappedData* data, bool* found,
                        map.getFileOffsetBytes());
 }
 
+// Raw data records smaller than this aren't worth deduplicating.
+static const size_t raw_data_dedup_min_size = 4096;
+// Only refer back to raw data written at most this many bytes earlier in
+// the RAW_DATA substream, so readers usually still have it cached.
+static const uint64_t raw_data_dedup_window = 64 * 1024 * 1024;
+
+static void hash_raw_data(const void* data, size_t len, uint8_t* out,
+                          size_t out_len) {
+  if (blake2b(out, out_len, data, len, nullptr, 0)) {
+    FATAL() << "blake2b failed";
+  }
+}
+
+uint64_t TraceWriter::find_duplicate_raw_data(const void* data, size_t len) {
+  if (len < raw_data_dedup_min_size) {
+    return NOT_DEDUPLICATED;
+  }
+  uint64_t offset = writer(RAW_DATA).bytes_written();
+  while (!raw_data_hash_order.empty() &&
+         raw_data_hash_order.front().first + raw_data_dedup_window < offset) {
+    auto it = raw_data_hashes.find(raw_data_hash_order.front().second);
+    if (it != raw_data_hashes.end() &&
+        it->second.offset == raw_data_hash_order.front().first) {
+      raw_data_hashes.erase(it);
+    }
+    raw_data_hash_order.pop_front();
+  }
+
+  RawDataHash hash;
+  hash_raw_data(data, len, hash.bytes, sizeof(hash.bytes));
+  auto it = raw_data_hashes.find(hash);
+  if (it != raw_data_hashes.end() && it->second.size == len) {
+    return it->second.offset;
+  }
+  // The caller is about to write this data at 'offset'.
+  raw_data_hashes[hash] = { offset, len };
+  raw_data_hash_order.push_back(make_pair(offset, hash));
+  return NOT_DEDUPLICATED;
+}
+
+// Runs of zeroes at least this long are recorded as WriteHoles instead of
+// being passed to the compressor.
+static const size_t raw_data_min_hole_size = 4096;
+// Zero runs are found at this granularity.
+static const size_t zero_scan_line_size = 64;
+
+static bool is_zero_line(const uint8_t* p) {
+  // Written so the compiler can vectorize it; no early exit.
+  uint64_t words[zero_scan_line_size / sizeof(uint64_t)];
+  memcpy(words, p, sizeof(words));
+  uint64_t acc = 0;
+  for (auto w : words) {
+    acc |= w;
+  }
+  return !acc;
+}
+
+static vector<WriteHole> find_zero_runs(const uint8_t* data, size_t len) {
+  vector<WriteHole> holes;
+  size_t lines_end = len - len % zero_scan_line_size;
+  size_t run_start = 0;
+  bool in_run = false;
+  for (size_t offset = 0; offset < lines_end;
+       offset += zero_scan_line_size) {
+    if (is_zero_line(data + offset)) {
+      if (!in_run) {
+        run_start = offset;
+        in_run = true;
+      }
+    } else if (in_run) {
+      if (offset - run_start >= raw_data_min_hole_size) {
+        holes.push_back({ run_start, offset - run_start });
+      }
+      in_run = false;
+    }
+  }
+  if (in_run) {
+    size_t end = lines_end;
+    while (end < len && !data[end]) {
+      ++end;
+    }
+    if (end < len) {
+      end = lines_end;
+    }
+    if (end - run_start >= raw_data_min_hole_size) {
+      holes.push_back({ run_start, end - run_start });
+    }
+  }
+  return holes;
+}
+
+void TraceWriter::write_raw(pid_t rec_tid, const void* d, size_t len,
+                            remote_ptr<void> addr) {
+  if (len >= raw_data_min_hole_size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(d);
+    vector<WriteHole> holes = find_zero_runs(bytes, len);
+    if (!holes.empty()) {
+      uint64_t offset = 0;
+      for (auto& h : holes) {
+        write_raw_data(bytes + offset, h.offset - offset);
+        offset = h.offset + h.size;
+      }
+      write_raw_data(bytes + offset, len - offset);
+      write_raw_header(rec_tid, len, addr, holes);
+      return;
+    }
+  }
+
+  uint64_t dedup_offset = find_duplicate_raw_data(d, len);
+  if (dedup_offset == NOT_DEDUPLICATED) {
+    write_raw_data(d, len);
+  }
+  raw_recs.push_back({ addr, len, rec_tid, vector<WriteHole>(), dedup_offset });
+}
+
+// 'data' is at the start of the RAW_DATA writer's reserved space. Commits
+// what needs to be kept and returns its size.
+size_t TraceWriter::write_raw_in_place(pid_t rec_tid, uint8_t* data,
+                                       size_t len, remote_ptr<void> addr) {
+  auto& w = writer(RAW_DATA);
+  if (len >= raw_data_min_hole_size) {
+    vector<WriteHole> holes = find_zero_runs(data, len);
+    if (!holes.empty()) {
+      // Squeeze out the holes.
+      size_t kept = 0;
+      uint64_t offset = 0;
+      for (auto& h : holes) {
+        memmove(data + kept, data + offset, h.offset - offset);
+        kept += h.offset - offset;
+        offset = h.offset + h.size;
+      }
+      memmove(data + kept, data + offset, len - offset);
+      kept += len - offset;
+      w.commit(kept);
+      write_raw_header(rec_tid, len, addr, holes);
+      return kept;
+    }
+  }
+
+  uint64_t dedup_offset = find_duplicate_raw_data(data, len);
+  size_t kept = 0;
+  if (dedup_offset == NOT_DEDUPLICATED) {
+    w.commit(len);
+    kept = len;
+  }
+  raw_recs.push_back({ addr, len, rec_tid, vector<WriteHole>(), dedup_offset });
+  return kept;
+}
+
+void TraceWriter::write_raw_ranges(pid_t rec_tid, const MemoryRange* ranges,
+                                   size_t count,
+                                   const function<void(uint8_t*)>& read) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    total += ranges[i].size();
+  }
+  uint8_t* buf = writer(RAW_DATA).reserve(total);
+  if (!buf) {
+    vector<uint8_t> data(total);
+    read(data.data());
+    const uint8_t* p = data.data();
+    for (size_t i = 0; i < count; ++i) {
+      write_raw(rec_tid, p, ranges[i].size(), ranges[i].start());
+      p += ranges[i].size();
+    }
+    return;
+  }
+
+  read(buf);
+  // Each record's data is moved down over whatever earlier records didn't
+  // keep, so it starts at the writer's current position.
+  const uint8_t* in = buf;
+  uint8_t* out = buf;
+  for (size_t i = 0; i < count; ++i) {
+    size_t len = ranges[i].size();
+    memmove(out, in, len);
+    out += write_raw_in_place(rec_tid, out, len, ranges[i].start());
+    in += len;
+  }
+}
+
 void TraceWriter::write_raw_header(pid_t rec_tid, size_t total_len,
                                    remote_ptr<void> addr,
                                    const std::vector<WriteHole>& holes = std::vector<WriteHole>()) {
-  raw_recs.push_back({ addr, total_len, rec_tid, holes });
+  raw_recs.push_back({ addr, total_len, rec_tid, holes, NOT_DEDUPLICATED });
 }
 
 void TraceWriter::write_raw_data(const void* d, size_t len) {
@@ -1215,6 +1563,66 @@ TraceReader::RawData TraceReader::read_raw_data() {
   return d;
 }
 
+/**
+ * Raw data records that later records may refer back to, keyed by the
+ * offset of their data in the uncompressed RAW_DATA substream. Entries are
+ * evicted oldest first once they take up more than raw_data_dedup_window
+ * bytes.
+ */
+struct TraceReader::RawDataCache {
+  std::map<uint64_t, std::shared_ptr<const std::vector<uint8_t>>> entries;
+  std::deque<uint64_t> order;
+  size_t total_size = 0;
+
+  void add(uint64_t offset, const void* data, size_t size) {
+    if (size < raw_data_dedup_min_size || entries.count(offset)) {
+      return;
+    }
+    auto d = make_shared<vector<uint8_t>>(
+        static_cast<const uint8_t*>(data),
+        static_cast<const uint8_t*>(data) + size);
+    entries[offset] = d;
+    order.push_back(offset);
+    total_size += size;
+    while (total_size > raw_data_dedup_window) {
+      auto it = entries.find(order.front());
+      total_size -= it->second->size();
+      entries.erase(it);
+      order.pop_front();
+    }
+  }
+};
+
+void TraceReader::read_raw_bytes(void* data, size_t size) {
+  reader(RAW_DATA).read(data, size);
+  raw_data_offset += size;
+}
+
+shared_ptr<const vector<uint8_t>> TraceReader::read_deduplicated_raw_data(
+    const RawDataMetadata& rec) {
+  auto it = raw_data_cache->entries.find(rec.dedup_offset);
+  if (it != raw_data_cache->entries.end() &&
+      it->second->size() == rec.size) {
+    return it->second;
+  }
+
+  // We skipped over the original or it's been evicted. Go and get it.
+  if (!raw_data_lookup_reader) {
+    raw_data_lookup_reader.reset(new CompressedReader(path(RAW_DATA)));
+  }
+  auto& r = *raw_data_lookup_reader;
+  if (!seek_reader(r, RAW_DATA, rec.dedup_offset)) {
+    r.rewind();
+    r.skip(rec.dedup_offset);
+  }
+  auto d = make_shared<vector<uint8_t>>(rec.size);
+  if (!r.read(d->data(), d->size())) {
+    FATAL() << "Can't read deduplicated raw data at " << rec.dedup_offset;
+  }
+  raw_data_cache->add(rec.dedup_offset, d->data(), d->size());
+  return d;
+}
+
 bool TraceReader::read_raw_data_for_frame(RawData& d) {
   if (raw_recs.empty()) {
     return false;
@@ -1223,6 +1631,13 @@ bool TraceReader::read_raw_data_for_frame(RawData& d) {
   d.rec_tid = rec.rec_tid;
   d.addr = rec.addr;
 
+  if (rec.dedup_offset != NOT_DEDUPLICATED) {
+    d.data = *read_deduplicated_raw_data(rec);
+    raw_recs.pop_back();
+    return true;
+  }
+
+  uint64_t data_offset = raw_data_offset;
   d.data.resize(rec.size);
   auto hole_iter = rec.holes.begin();
   uintptr_t offset = 0;
@@ -1237,9 +1652,12 @@ bool TraceReader::read_raw_data_for_frame(RawData& d) {
       }
       end = hole_iter->offset;
     }
-    reader(RAW_DATA).read((char*)d.data.data() + offset, end - offset);
+    read_raw_bytes((char*)d.data.data() + offset, end - offset);
     offset = end;
   }
+  if (rec.holes.empty()) {
+    raw_data_cache->add(data_offset, d.data.data(), d.data.size());
+  }
 
   raw_recs.pop_back();
   return true;
@@ -1252,13 +1670,24 @@ bool TraceReader::read_raw_data_for_frame_with_holes(RawDataWithHoles& d) {
   auto& rec = raw_recs[raw_recs.size() - 1];
   d.rec_tid = rec.rec_tid;
   d.addr = rec.addr;
+  if (rec.dedup_offset != NOT_DEDUPLICATED) {
+    d.holes.clear();
+    d.data = *read_deduplicated_raw_data(rec);
+    raw_recs.pop_back();
+    return true;
+  }
+
   d.holes = move(rec.holes);
   size_t data_size = rec.size;
   for (auto& h : d.holes) {
     data_size -= h.size;
   }
+  uint64_t data_offset = raw_data_offset;
   d.data.resize(data_size);
-  reader(RAW_DATA).read((char*)d.data.data(), data_size);
+  read_raw_bytes((char*)d.data.data(), data_size);
+  if (d.holes.empty()) {
+    raw_data_cache->add(data_offset, d.data.data(), d.data.size());
+  }
 
   raw_recs.pop_back();
   return true;
@@ -1269,11 +1698,14 @@ bool TraceReader::read_raw_data_metadata_for_frame(RawDataMetadata& d) {
     return false;
   }
   d = raw_recs[raw_recs.size() - 1];
-  size_t data_size = d.size;
-  for (auto& h : d.holes) {
-    data_size -= h.size;
+  if (d.dedup_offset == NOT_DEDUPLICATED) {
+    size_t data_size = d.size;
+    for (auto& h : d.holes) {
+      data_size -= h.size;
+    }
+    reader(RAW_DATA).skip(data_size);
+    raw_data_offset += data_size;
   }
-  reader(RAW_DATA).skip(data_size);
   raw_recs.pop_back();
   return true;
 }
@@ -1401,6 +1833,8 @@ void TraceWriter::close(CloseStatus status, const TraceUuid* uuid) {
     w->close();
   }
 
+  write_index();
+
   MallocMessageBuilder header_msg;
   trace::Header::Builder header = header_msg.initRoot<trace::Header>();
   header.setBindToCpu(this->bind_to_cpu);
@@ -1461,6 +1895,155 @@ void TraceWriter::close(CloseStatus status, const TraceUuid* uuid) {
     FATAL() << "Unable to create version file " << path;
   }
   version_fd.close();
+
+  if (sink) {
+    send_to_sink("");
+    // The version file goes last, so a partially received trace is never
+    // mistaken for a complete one.
+    sink->write_file(path, "version");
+    sink->end();
+    sink = nullptr;
+    unlink(path.c_str());
+    if (rmdir(trace_dir.c_str()) < 0) {
+      LOG(warn) << "Unable to remove local trace directory " << trace_dir;
+    }
+  }
+}
+
+// Send every file under 'rel_dir' except the version file to the sink,
+// deleting them as we go. Substream files only hold the blocks written
+// before streaming started.
+void TraceWriter::send_to_sink(const string& rel_dir) {
+  string dir_path = rel_dir.empty() ? trace_dir : trace_dir + "/" + rel_dir;
+  DIR* dir = opendir(dir_path.c_str());
+  if (!dir) {
+    FATAL() << "Can't open " << dir_path;
+  }
+  vector<string> names;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) {
+      names.push_back(ent->d_name);
+    }
+  }
+  closedir(dir);
+
+  for (auto& name : names) {
+    string rel_name = rel_dir.empty() ? name : rel_dir + "/" + name;
+    if (rel_name == "version") {
+      continue;
+    }
+    string file_path = trace_dir + "/" + rel_name;
+    struct stat st;
+    if (lstat(file_path.c_str(), &st) < 0) {
+      FATAL() << "Can't stat " << file_path;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      send_to_sink(rel_name);
+      rmdir(file_path.c_str());
+    } else if (S_ISREG(st.st_mode)) {
+      sink->write_file(file_path, rel_name);
+      unlink(file_path.c_str());
+    } else {
+      LOG(warn) << "Not streaming " << file_path << ": not a regular file";
+    }
+  }
+}
+
+void TraceWriter::write_index() {
+  MallocMessageBuilder index_msg;
+  trace::TraceIndex::Builder index = index_msg.initRoot<trace::TraceIndex>();
+  auto chunks = index.initSubstreamChunks(SUBSTREAM_COUNT);
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    auto& blocks = writer(s).block_locations();
+    auto list = chunks.init(s, blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      list[i].setFileOffset(blocks[i].fd_offset);
+      list[i].setUncompressedOffset(blocks[i].uncompressed_offset);
+    }
+  }
+  auto frames = index.initFrames(frame_positions.size());
+  for (size_t i = 0; i < frame_positions.size(); ++i) {
+    frames[i].setFrameTime(frame_positions[i].time);
+    auto offsets = frames[i].initSubstreamOffsets(SUBSTREAM_COUNT);
+    for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+      offsets.set(s, frame_positions[i].offsets[s]);
+    }
+  }
+
+  string path = index_path();
+  ScopedFd fd(path.c_str(), O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL, 0400);
+  if (!fd.is_open()) {
+    FATAL() << "Unable to create " << path;
+  }
+  try {
+    writePackedMessageToFd(fd, index_msg);
+  } catch (...) {
+    FATAL() << "Unable to write " << path;
+  }
+}
+
+bool TraceWriter::rewrite_index(
+    const string& in_path, const string& out_path,
+    const vector<CompressedWriter::BlockLocation> (&blocks)[SUBSTREAM_COUNT]) {
+  ScopedFd in_fd(in_path.c_str(), O_CLOEXEC | O_RDONLY);
+  if (!in_fd.is_open()) {
+    return false;
+  }
+  MallocMessageBuilder index_msg;
+  trace::TraceIndex::Builder index = index_msg.initRoot<trace::TraceIndex>();
+  try {
+    ReaderOptions options;
+    options.traversalLimitInWords = UINT64_MAX;
+    PackedFdMessageReader in_msg(in_fd, options);
+    // Frame positions are uncompressed offsets, so they're unchanged.
+    index.setFrames(in_msg.getRoot<trace::TraceIndex>().getFrames());
+  } catch (...) {
+    LOG(warn) << "Unable to read " << in_path;
+    return false;
+  }
+
+  auto chunks = index.initSubstreamChunks(SUBSTREAM_COUNT);
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    auto list = chunks.init(s, blocks[s].size());
+    for (size_t i = 0; i < blocks[s].size(); ++i) {
+      list[i].setFileOffset(blocks[s][i].fd_offset);
+      list[i].setUncompressedOffset(blocks[s][i].uncompressed_offset);
+    }
+  }
+
+  ScopedFd out_fd(out_path.c_str(), O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL,
+                  0400);
+  if (!out_fd.is_open()) {
+    FATAL() << "Unable to create " << out_path;
+  }
+  try {
+    writePackedMessageToFd(out_fd, index_msg);
+  } catch (...) {
+    FATAL() << "Unable to write " << out_path;
+  }
+  if (fsync(out_fd) < 0) {
+    FATAL() << "Unable to sync " << out_path;
+  }
+  return true;
+}
+
+void TraceWriter::set_compression_level(int level, int max_level) {
+  for (auto& w : writers) {
+    w->set_compression_level(level, max_level);
+  }
+}
+
+void TraceWriter::stream_to(const string& spec) {
+  const char* trace_name = trace_dir.c_str();
+  const char* last = strrchr(trace_name, '/');
+  if (last) {
+    trace_name = last + 1;
+  }
+  sink = make_shared<TraceSink>(spec, trace_name);
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    writer(s).set_sink(sink, substream(s).name);
+  }
 }
 
 void TraceWriter::make_latest_trace() {
@@ -1500,18 +2083,152 @@ TraceFrame TraceReader::peek_frame() {
   return frame;
 }
 
+struct TraceReader::Index {
+  struct Position {
+    FrameTime time;
+    uint64_t offsets[SUBSTREAM_COUNT];
+  };
+  std::vector<CompressedWriter::BlockLocation> blocks[SUBSTREAM_COUNT];
+  std::vector<Position> positions;
+};
+
+shared_ptr<const TraceReader::Index> TraceReader::load_index() {
+  if (index_loaded) {
+    return index_;
+  }
+  index_loaded = true;
+
+  ScopedFd fd(index_path().c_str(), O_CLOEXEC | O_RDONLY);
+  if (!fd.is_open()) {
+    // Traces recorded by older rr versions don't have an index.
+    return nullptr;
+  }
+  auto index = make_shared<Index>();
+  try {
+    ReaderOptions options;
+    options.traversalLimitInWords = UINT64_MAX;
+    PackedFdMessageReader index_msg(fd, options);
+    trace::TraceIndex::Reader r = index_msg.getRoot<trace::TraceIndex>();
+    auto chunks = r.getSubstreamChunks();
+    if (chunks.size() != SUBSTREAM_COUNT) {
+      LOG(warn) << "Ignoring trace index with wrong substream count";
+      return nullptr;
+    }
+    for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+      uint64_t file_size = reader(s).compressed_bytes();
+      for (auto c : chunks[s]) {
+        CompressedWriter::BlockLocation b = { c.getFileOffset(),
+                                              c.getUncompressedOffset() };
+        if (b.fd_offset >= file_size ||
+            (!index->blocks[s].empty() &&
+             (b.fd_offset <= index->blocks[s].back().fd_offset ||
+              b.uncompressed_offset <=
+                  index->blocks[s].back().uncompressed_offset))) {
+          LOG(warn) << "Ignoring trace index that doesn't match "
+                    << path(s);
+          return nullptr;
+        }
+        index->blocks[s].push_back(b);
+      }
+    }
+    for (auto f : r.getFrames()) {
+      auto offsets = f.getSubstreamOffsets();
+      if (offsets.size() != SUBSTREAM_COUNT ||
+          (!index->positions.empty() &&
+           f.getFrameTime() <= index->positions.back().time)) {
+        LOG(warn) << "Ignoring invalid trace index";
+        return nullptr;
+      }
+      Index::Position pos;
+      pos.time = f.getFrameTime();
+      for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+        pos.offsets[s] = offsets[s];
+      }
+      index->positions.push_back(pos);
+    }
+  } catch (...) {
+    LOG(warn) << "Ignoring unreadable trace index";
+    return nullptr;
+  }
+  index_ = index;
+  return index_;
+}
+
+bool TraceReader::seek_to_frame(FrameTime time) {
+  shared_ptr<const Index> index = load_index();
+  if (!index) {
+    return false;
+  }
+  auto& positions = index->positions;
+  auto it = upper_bound(positions.begin(), positions.end(), time,
+                        [](FrameTime t, const Index::Position& p) {
+                          return t < p.time;
+                        });
+  if (it == positions.begin()) {
+    return true;
+  }
+  const Index::Position& pos = *(it - 1);
+  // The next frame we'll read is global_time + 1. If that's already at or
+  // past |pos|, reading forward is cheaper than seeking.
+  if (global_time + 1 >= pos.time) {
+    return true;
+  }
+
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    seek_reader(reader(s), s, pos.offsets[s]);
+  }
+  global_time = pos.time - 1;
+  raw_recs.clear();
+  raw_data_offset = pos.offsets[RAW_DATA];
+  last_frame_registers.clear();
+  return true;
+}
+
+// Positions |r|, a reader for substream |s|, at uncompressed |offset|
+// using the trace index. Returns false if there's no index.
+bool TraceReader::seek_reader(CompressedReader& r, Substream s,
+                              uint64_t offset) {
+  shared_ptr<const Index> index = load_index();
+  if (!index) {
+    return false;
+  }
+  auto& blocks = index->blocks[s];
+  auto b = upper_bound(blocks.begin(), blocks.end(), offset,
+                       [](uint64_t o, const CompressedWriter::BlockLocation& l) {
+                         return o < l.uncompressed_offset;
+                       });
+  bool ok;
+  if (b == blocks.begin()) {
+    // Empty substream, or |offset| is 0.
+    ok = offset == 0 && r.seek(0, 0);
+  } else {
+    --b;
+    ok = r.seek(b->fd_offset, offset - b->uncompressed_offset);
+  }
+  if (!ok) {
+    FATAL() << "Trace index doesn't match " << path(s);
+  }
+  return true;
+}
+
 void TraceReader::rewind() {
   for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
     reader(s).rewind();
   }
   global_time = 0;
+  raw_data_offset = 0;
+  last_frame_registers.clear();
   DEBUG_ASSERT(good());
 }
 
 TraceReader::TraceReader(const string& dir)
-    : TraceStream(resolve_trace_name(dir), 1) {
+    : TraceStream(resolve_trace_name(dir), 1),
+      index_loaded(false),
+      raw_data_offset(0),
+      raw_data_cache(make_shared<RawDataCache>()) {
   for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
-    readers[s] = unique_ptr<CompressedReader>(new CompressedReader(path(s)));
+    readers[s] = unique_ptr<CompressedReader>(
+        new CompressedReader(path(s), decompress_ahead(s)));
   }
 
   string path = version_path();
@@ -1682,6 +2399,11 @@ TraceReader::TraceReader(const TraceReader& other)
   quirks_ = other.quirks_;
   clear_fip_fdp_ = other.clear_fip_fdp_;
   required_forward_compatibility_version_ = other.required_forward_compatibility_version_;
+  index_ = other.index_;
+  index_loaded = other.index_loaded;
+  raw_data_offset = other.raw_data_offset;
+  raw_data_cache = other.raw_data_cache;
+  last_frame_registers = other.last_frame_registers;
 }
 
 TraceReader::~TraceReader() {}
@@ -3,8 +3,11 @@
 #ifndef RR_TRACE_STREAM_H_
 #define RR_TRACE_STREAM_H_
 
+#include <string.h>
 #include <unistd.h>
 
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -17,6 +20,7 @@
 #include "MemoryRange.h"
 #include "TaskishUid.h"
 #include "TraceFrame.h"
+#include "TraceSink.h"
 #include "TraceTaskEvent.h"
 #include "remote_ptr.h"
 
@@ -25,7 +29,7 @@ namespace rr {
 /**
  * Bump this when rr changes mean that traces produced by new rr can't be replayed by old rr.
  */
-const int FORWARD_COMPATIBILITY_VERSION = 3;
+const int FORWARD_COMPATIBILITY_VERSION = 9;
 
 struct CPUIDRecord;
 struct DisableCPUIDFeatures;
@@ -56,7 +60,12 @@ public:
     size_t size;
     pid_t rec_tid;
     std::vector<WriteHole> holes;
+    // If not NOT_DEDUPLICATED, the data isn't stored with this record.
+    // It's the same as the record whose data starts at this offset in the
+    // uncompressed RAW_DATA substream.
+    uint64_t dedup_offset;
   };
+  static const uint64_t NOT_DEDUPLICATED = UINT64_MAX;
 
   /**
    * Update |substreams| and TRACE_VERSION when you update this list.
@@ -76,6 +85,11 @@ public:
 
   /** Return the directory storing this trace's files. */
   const string& dir() const { return trace_dir; }
+  /**
+   * Return the path of the optional "index" file, which records where
+   * frames start in each substream so readers can seek.
+   */
+  string index_path() const { return trace_dir + "/index"; }
 
   int bound_to_cpu() const { return bind_to_cpu; }
   void set_bound_cpu(int bound) { bind_to_cpu = bound; }
@@ -89,6 +103,10 @@ public:
   std::string file_data_clone_file_name(const TaskUid& tuid);
 
   static size_t mmaps_block_size();
+  /** Name of the file storing |s|, relative to the trace directory. */
+  static const char* substream_file_name(Substream s);
+  /** Size of the blocks |s| is compressed in when recording. */
+  static size_t substream_block_size(Substream s);
 
   /**
    * For REMAP_MAPPING maps, the memory contents are preserved so we don't
@@ -135,6 +153,14 @@ protected:
    */
   void tick_time() { ++global_time; }
 
+  // The registers of the last frame with registers for each tid, as
+  // written to the trace. Frame registers are delta-encoded against these.
+  struct FrameRegisters {
+    SupportedArch arch;
+    std::vector<uint8_t> raw;
+  };
+  std::map<pid_t, FrameRegisters> last_frame_registers;
+
   // Directory into which we're saving the trace files.
   string trace_dir;
   // CPU core# that the tracees are bound to
@@ -219,15 +245,30 @@ public:
       CompressedWriter& mmaps, const MappedData& data, const KernelMapping& km,
       const std::vector<TraceRemoteFd>& extra_fds, bool skip_monitoring_mapped_fd);
 
+  /**
+   * Write the index at |in_path| to |out_path|, replacing its block
+   * locations with |blocks|. Used when substreams have been rewritten with
+   * the same uncompressed contents. Returns false without creating
+   * |out_path| if |in_path| doesn't exist or can't be read.
+   */
+  static bool rewrite_index(
+      const std::string& in_path, const std::string& out_path,
+      const std::vector<CompressedWriter::BlockLocation> (&blocks)[SUBSTREAM_COUNT]);
+
   /**
    * Write a raw-data record to the trace.
    * 'addr' is the address in the tracee where the data came from/will be
    * restored to.
    */
-  void write_raw(pid_t tid, const void* data, size_t len, remote_ptr<void> addr) {
-    write_raw_data(data, len);
-    write_raw_header(tid, len, addr, std::vector<WriteHole>());
-  }
+  void write_raw(pid_t tid, const void* data, size_t len, remote_ptr<void> addr);
+  /**
+   * Like calling write_raw() for each of the 'count' 'ranges', but 'read'
+   * is called once to fill a buffer with the data of all of them,
+   * concatenated. When possible that buffer is the RAW_DATA writer's own,
+   * so the data is never copied.
+   */
+  void write_raw_ranges(pid_t tid, const MemoryRange* ranges, size_t count,
+                        const std::function<void(uint8_t*)>& read);
   void write_raw_data(const void* data, size_t len);
   void write_raw_header(pid_t tid, size_t total_len, remote_ptr<void> addr,
                         const std::vector<WriteHole>& holes);
@@ -287,6 +328,20 @@ public:
    */
   void make_latest_trace();
 
+  /**
+   * Set the compression level for all substreams. See
+   * CompressedWriter::set_compression_level.
+   */
+  void set_compression_level(int level, int max_level);
+
+  /**
+   * Send the trace to a TraceSink as it's written. 'spec' is an fd number
+   * or the path of a Unix socket `rr receive` is listening on. Substream
+   * blocks are sent as soon as they're written; the remaining files are
+   * sent by close(), which then deletes the local trace directory.
+   */
+  void stream_to(const std::string& spec);
+
   TicksSemantics ticks_semantics() const { return ticks_semantics_; }
 
 private:
@@ -301,7 +356,21 @@ private:
   CompressedWriter& writer(Substream s) { return *writers[s]; }
   const CompressedWriter& writer(Substream s) const { return *writers[s]; }
 
+  void index_frame_position();
+  void write_index();
+  void send_to_sink(const std::string& rel_dir);
+  uint64_t find_duplicate_raw_data(const void* data, size_t len);
+  size_t write_raw_in_place(pid_t tid, uint8_t* data, size_t len,
+                            remote_ptr<void> addr);
+
   std::unique_ptr<CompressedWriter> writers[SUBSTREAM_COUNT];
+  std::shared_ptr<TraceSink> sink;
+  struct FramePosition {
+    FrameTime time;
+    // Uncompressed offset in each substream of the first data for 'time'
+    uint64_t offsets[SUBSTREAM_COUNT];
+  };
+  std::vector<FramePosition> frame_positions;
   /**
    * Files that have already been mapped without being copied to the trace,
    * i.e. that we have already assumed to be immutable.
@@ -311,6 +380,20 @@ private:
    */
   std::map<std::pair<dev_t, ino_t>, std::string> files_assumed_immutable;
   std::vector<RawDataMetadata> raw_recs;
+  struct RawDataHash {
+    uint8_t bytes[32];
+    bool operator<(const RawDataHash& other) const {
+      return memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+    }
+  };
+  struct RawDataLocation {
+    uint64_t offset;
+    size_t size;
+  };
+  // Recently written raw data that later writes can refer back to,
+  // and the same keys in the order they were written.
+  std::map<RawDataHash, RawDataLocation> raw_data_hashes;
+  std::deque<std::pair<uint64_t, RawDataHash>> raw_data_hash_order;
   std::vector<CPUIDRecord> cpuid_records;
   TicksSemantics ticks_semantics_;
   // Keep the 'incomplete' (later renamed to 'version') file open until we
@@ -428,6 +511,14 @@ public:
    */
   void rewind();
 
+  /**
+   * Using the trace index, skip forward to a frame at or before |time|, so
+   * that reading frames from there reaches |time| without decompressing
+   * the whole trace prefix. Never moves backwards. Returns false if the
+   * trace has no usable index, in which case nothing changes.
+   */
+  bool seek_to_frame(FrameTime time);
+
   uint64_t uncompressed_bytes() const;
   uint64_t compressed_bytes() const;
 
@@ -495,8 +586,27 @@ private:
   CompressedReader& reader(Substream s) { return *readers[s]; }
   const CompressedReader& reader(Substream s) const { return *readers[s]; }
 
+  struct Index;
+  // Null if the trace has no usable index or we haven't loaded it yet.
+  std::shared_ptr<const Index> load_index();
+  bool seek_reader(CompressedReader& r, Substream s, uint64_t offset);
+
+  struct RawDataCache;
+  void read_raw_bytes(void* data, size_t size);
+  std::shared_ptr<const std::vector<uint8_t>> read_deduplicated_raw_data(
+      const RawDataMetadata& rec);
+
   uint64_t xcr0_;
   std::unique_ptr<CompressedReader> readers[SUBSTREAM_COUNT];
+  std::shared_ptr<const Index> index_;
+  bool index_loaded;
+  // Offset in the uncompressed RAW_DATA substream we're reading from
+  uint64_t raw_data_offset;
+  // Recently read raw data, shared with copies of this reader
+  std::shared_ptr<RawDataCache> raw_data_cache;
+  // Reads earlier raw data that has dropped out of raw_data_cache.
+  // Created on demand.
+  std::unique_ptr<CompressedReader> raw_data_lookup_reader;
   std::vector<CPUIDRecord> cpuid_records_;
   std::vector<RawDataMetadata> raw_recs;
   TicksSemantics ticks_semantics_;
@@ -2,6 +2,7 @@
 
 import assembly_templates
 from io import StringIO
+import ioctls
 import os
 import string
 import sys
@@ -145,6 +146,23 @@ def write_check_syscall_numbers(f):
         f.write("""static_assert(X86Arch::%s == SYS_%s, "Incorrect syscall number for %s");\n"""
                 % (name, name, name))
 
+def write_syscallbuf_ioctls(f):
+    f.write("/* Generated from ioctls.py. Entries for syscallbuf.c's\n")
+    f.write("   syscallbuf_ioctls table. */\n")
+    for i, (preprocessor, arch) in enumerate([("defined(__i386__)", "x86"),
+                                              ("defined(__x86_64__)", "x64"),
+                                              ("defined(__aarch64__)", "generic")]):
+        f.write("#%s %s\n" % ("if" if i == 0 else "elif", preprocessor))
+        for name, obj in sorted(ioctls.all(), key=lambda x: getattr(x[1], arch) or 0):
+            number = getattr(obj, arch)
+            if number is None:
+                continue
+            f.write("  { 0x%x, SYSCALLBUF_IOCTL_%s, SYSCALLBUF_IOCTL_%s, %d }, /* %s */\n"
+                    % (number, obj.direction, obj.effect, obj.size_for(arch), name))
+    f.write("#else\n")
+    f.write("#error Unknown architecture\n")
+    f.write("#endif\n")
+
 generators_for = {
     'AssemblyTemplates': lambda f: assembly_templates.generate(f),
     'CheckSyscallNumbers': write_check_syscall_numbers,
@@ -157,6 +175,7 @@ generators_for = {
     'SyscallnameArch': write_syscallname_arch,
     'SyscallRecordCase': write_syscall_record_cases,
     'SyscallHelperFunctions': write_syscall_helper_functions,
+    'SyscallbufIoctls': write_syscallbuf_ioctls,
 }
 
 def main(argv):
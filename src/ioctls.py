@@ -0,0 +1,96 @@
+class BufferedIoctl(object):
+    """An ioctl request that the syscallbuf handles without a ptrace stop.
+
+    |x86|, |x64| and |generic| are the request numbers. An ioctl whose number
+    is None on an architecture is never buffered there.
+
+    |direction| says how the kernel uses the memory the third argument points
+    to: NONE (the argument isn't a pointer, or isn't used), IN (read only),
+    OUT (written) or INOUT (read, then written). For OUT and INOUT, |size| is
+    the number of bytes the kernel writes; it may be a dict keyed by
+    architecture when the type's size differs.
+
+    |effect| classifies what else the ioctl does:
+      QUERY: nothing.
+      FD_STATE: changes flags of the file descriptor or open file.
+      DEVICE_STATE: changes the state of the underlying device.
+      MAY_BLOCK: like DEVICE_STATE, but may wait (e.g. for output to drain).
+
+    Only list ioctls whose effects rr doesn't need to observe, and whose
+    outputs are exactly |size| bytes at the argument. Anything else must stay
+    traced so that record_syscall.cc can handle it.
+    """
+    def __init__(self, x86=None, x64=None, generic=None, direction='NONE',
+                 size=0, effect='QUERY'):
+        assert x86 or x64 or generic
+        assert direction in ('NONE', 'IN', 'OUT', 'INOUT')
+        assert effect in ('QUERY', 'FD_STATE', 'DEVICE_STATE', 'MAY_BLOCK')
+        assert (size != 0) == (direction in ('OUT', 'INOUT'))
+        self.x86 = x86
+        self.x64 = x64
+        self.generic = generic
+        self.direction = direction
+        self.size = size
+        self.effect = effect
+
+    def size_for(self, arch):
+        if isinstance(self.size, dict):
+            return self.size[arch]
+        return self.size
+
+# Terminals. Note that the kernel's struct termios is 36 bytes, not glibc's.
+TCGETS = BufferedIoctl(x86=0x5401, x64=0x5401, generic=0x5401, direction='OUT', size=36)
+TCSETS = BufferedIoctl(x86=0x5402, x64=0x5402, generic=0x5402, direction='IN', effect='DEVICE_STATE')
+TCSETSW = BufferedIoctl(x86=0x5403, x64=0x5403, generic=0x5403, direction='IN', effect='MAY_BLOCK')
+TCSETSF = BufferedIoctl(x86=0x5404, x64=0x5404, generic=0x5404, direction='IN', effect='MAY_BLOCK')
+TCFLSH = BufferedIoctl(x86=0x540b, x64=0x540b, generic=0x540b, effect='DEVICE_STATE')
+TIOCGPGRP = BufferedIoctl(x86=0x540f, x64=0x540f, generic=0x540f, direction='OUT', size=4)
+TIOCOUTQ = BufferedIoctl(x86=0x5411, x64=0x5411, generic=0x5411, direction='OUT', size=4)
+TIOCGWINSZ = BufferedIoctl(x86=0x5413, x64=0x5413, generic=0x5413, direction='OUT', size=8)
+FIONREAD = BufferedIoctl(x86=0x541b, x64=0x541b, generic=0x541b, direction='OUT', size=4)
+FIONBIO = BufferedIoctl(x86=0x5421, x64=0x5421, generic=0x5421, direction='IN', effect='FD_STATE')
+TIOCGETD = BufferedIoctl(x86=0x5424, x64=0x5424, generic=0x5424, direction='OUT', size=4)
+TIOCGSID = BufferedIoctl(x86=0x5429, x64=0x5429, generic=0x5429, direction='OUT', size=4)
+TCGETS2 = BufferedIoctl(x86=0x802c542a, x64=0x802c542a, generic=0x802c542a, direction='OUT', size=44)
+TIOCGPTN = BufferedIoctl(x86=0x80045430, x64=0x80045430, generic=0x80045430, direction='OUT', size=4)
+FIONCLEX = BufferedIoctl(x86=0x5450, x64=0x5450, generic=0x5450, effect='FD_STATE')
+FIOCLEX = BufferedIoctl(x86=0x5451, x64=0x5451, generic=0x5451, effect='FD_STATE')
+
+# Sockets. 32-bit tasks on 64-bit kernels can have the SIOCGIF* ioctls
+# translated through scratch memory below the user stack pointer, which the
+# syscallbuf wouldn't record (see record_page_below_stack_ptr), so those
+# stay traced on x86.
+SIOCATMARK = BufferedIoctl(x86=0x8905, x64=0x8905, generic=0x8905, direction='OUT', size=4)
+SIOCGIFNAME = BufferedIoctl(x64=0x8910, generic=0x8910, direction='INOUT', size=40)
+SIOCGIFFLAGS = BufferedIoctl(x64=0x8913, generic=0x8913, direction='INOUT', size=40)
+SIOCGIFADDR = BufferedIoctl(x64=0x8915, generic=0x8915, direction='INOUT', size=40)
+SIOCGIFNETMASK = BufferedIoctl(x64=0x891b, generic=0x891b, direction='INOUT', size=40)
+SIOCGIFMTU = BufferedIoctl(x64=0x8921, generic=0x8921, direction='INOUT', size=40)
+SIOCGIFHWADDR = BufferedIoctl(x64=0x8927, generic=0x8927, direction='INOUT', size=40)
+SIOCGIFINDEX = BufferedIoctl(x64=0x8933, generic=0x8933, direction='INOUT', size=40)
+
+# Block devices
+BLKROGET = BufferedIoctl(x86=0x125e, x64=0x125e, generic=0x125e, direction='OUT', size=4)
+BLKGETSIZE = BufferedIoctl(x86=0x1260, x64=0x1260, generic=0x1260, direction='OUT',
+                           size={'x86': 4, 'x64': 8, 'generic': 8})
+BLKSSZGET = BufferedIoctl(x86=0x1268, x64=0x1268, generic=0x1268, direction='OUT', size=4)
+# Encoded with sizeof(size_t), but always writes a u64.
+BLKGETSIZE64 = BufferedIoctl(x86=0x80041272, x64=0x80081272, generic=0x80081272, direction='OUT', size=8)
+BLKIOMIN = BufferedIoctl(x86=0x1278, x64=0x1278, generic=0x1278, direction='OUT', size=4)
+BLKIOOPT = BufferedIoctl(x86=0x1279, x64=0x1279, generic=0x1279, direction='OUT', size=4)
+BLKPBSZGET = BufferedIoctl(x86=0x127b, x64=0x127b, generic=0x127b, direction='OUT', size=4)
+
+# DRM
+DRM_IOCTL_GET_MAGIC = BufferedIoctl(x86=0x80046402, x64=0x80046402, generic=0x80046402, direction='OUT', size=4)
+DRM_IOCTL_GET_CAP = BufferedIoctl(x86=0xc010640c, x64=0xc010640c, generic=0xc010640c, direction='INOUT', size=16)
+
+# Filesystems
+BTRFS_IOC_CLONE_RANGE = BufferedIoctl(x86=0x4020940d, x64=0x4020940d, generic=0x4020940d, direction='IN', effect='DEVICE_STATE')
+
+def _ioctls():
+    for name, obj in globals().items():
+        if isinstance(obj, BufferedIoctl):
+            yield (name, obj)
+
+def all():
+    return sorted(_ioctls(), key=lambda x: x[0])
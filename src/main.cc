@@ -55,6 +55,10 @@ void print_global_options(FILE* out) {
       "Global options:\n"
       "  --disable-cpuid-faulting   disable use of CPUID faulting\n"
       "  --disable-ptrace-exit_events disable use of PTRACE_EVENT_EXIT\n"
+      "  --decompress-ahead=<N>     when reading traces, decompress up to N\n"
+      "                             blocks of each substream ahead of the\n"
+      "                             read position on background threads.\n"
+      "                             0 disables this.\n"
       "  --resource-path=PATH       specify the paths that rr should use to "
       "find\n"
       "                             files such as rr_page_*.  These files "
@@ -128,6 +132,7 @@ bool parse_global_option(std::vector<std::string>& args) {
     { 2, "resource-path", HAS_PARAMETER },
     { 3, "log", HAS_PARAMETER },
     { 4, "non-interactive", NO_PARAMETER },
+    { 5, "decompress-ahead", HAS_PARAMETER },
     { 'A', "microarch", HAS_PARAMETER },
     { 'C', "checksum", HAS_PARAMETER },
     { 'D', "dump-on", HAS_PARAMETER },
@@ -166,6 +171,12 @@ bool parse_global_option(std::vector<std::string>& args) {
     case 4:
       flags.non_interactive = true;
       break;
+    case 5:
+      if (!opt.verify_valid_int(0, 64)) {
+        print_usage(stderr);
+      }
+      flags.decompress_ahead = opt.int_value;
+      break;
     case 'A':
       flags.forced_uarch = opt.value;
       break;
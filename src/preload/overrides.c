@@ -200,9 +200,13 @@ void spurious_desched_syscall(struct syscall_info* info) {
  * is pointing to the syscallbuf alt-stack, outside the stack region it
  * expects, which causes it to freak out.
  * So, override sched_yield() to perform the syscall in a way that can't
- * be syscall-buffered.
+ * be syscall-buffered, unless we're the only thread and there's no helper
+ * to get confused.
  */
 int sched_yield(void) {
+  if (globals.single_task) {
+    return syscall(SYS_sched_yield);
+  }
 #ifdef __i386__
   // We have no syscall hook for `syscall` followed by `inc %ecx`
   int trash;
@@ -208,13 +208,41 @@ struct syscall_patch_hook {
  * we flush the syscallbuf, and its effects performed. The actual mprotect
  * syscalls are performed during recording and replay.
  *
+ * Buffered private anonymous mmaps and buffered munmaps use the same list,
+ * distinguished by |kind|, so that all the layout changes are applied in
+ * order. Older traces always have MPROTECT_RECORD_MPROTECT here.
+ *
  * We simplify things by making this arch-independent.
  */
+enum {
+  MPROTECT_RECORD_MPROTECT = 0,
+  /* A MAP_PRIVATE | MAP_ANONYMOUS mapping was created at |start| */
+  MPROTECT_RECORD_MMAP = 1,
+  /* |start| to |start + size| was unmapped. |prot| is unused. */
+  MPROTECT_RECORD_MUNMAP = 2,
+};
 struct mprotect_record {
   uint64_t start;
   uint64_t size;
   int32_t prot;
-  int32_t padding;
+  int32_t kind;
+};
+
+/**
+ * When rr records accept, accept4 or connect as traced syscalls it saves the
+ * addresses of the new connection (see `rr dump --socket-addresses`). The
+ * buffered versions save them in one of these, filled in with
+ * getsockname/getpeername, as the extra data of a getpeername record right
+ * after the accept/connect record. rr picks them up when it flushes the
+ * syscallbuf. An address that wasn't retrieved has family 0.
+ *
+ * Must be arch-independent.
+ */
+struct syscallbuf_socket_addrs {
+  uint32_t local_len;
+  uint32_t remote_len;
+  uint8_t local[128];
+  uint8_t remote[128];
 };
 
 /**
@@ -268,6 +296,10 @@ struct preload_globals {
      fd table. Set by rr during record (modifications are recorded).
      Read by the syscallbuf */
   unsigned char fdt_uniform;
+  /* Indicates whether this address space has only one task. Set by rr during
+     record (modifications are recorded). Read by the syscallbuf to decide
+     whether sched_yield can be buffered */
+  unsigned char single_task;
 };
 
 /**
@@ -514,7 +546,8 @@ struct syscallbuf_hdr {
    * updates to this field. */
   volatile uint32_t num_rec_bytes;
   /* Number of mprotect calls since last syscallbuf flush. The last record in
-   * the list may not have been applied yet.
+   * the list may not have been applied yet. mmap and munmap records are only
+   * added once their syscall has completed, so that can only be an mprotect.
    */
   volatile uint32_t mprotect_record_count;
   /* Number of records whose syscalls have definitely completed.
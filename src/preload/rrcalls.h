@@ -100,4 +100,12 @@
  * The RDTSC value is returned as a 64-bit value stored in the
  * memory location given by the first argument. RAX returns 0.
  */
-#define SYS_rrcall_rdtsc (RR_CALL_BASE + 12)
\ No newline at end of file
+#define SYS_rrcall_rdtsc (RR_CALL_BASE + 12)
+/**
+ * Like SYS_rrcall_mprotect_record, but for syscallbuf 'mmap' and 'munmap'
+ * records. The first parameter is the tid of the task, the second parameter
+ * is the address, the third parameter is the length, and the fourth parameter
+ * is the prot of the new private anonymous mapping, or -1 if the range was
+ * unmapped.
+ */
+#define SYS_rrcall_mmap_record (RR_CALL_BASE + 13)
\ No newline at end of file
@@ -59,6 +59,7 @@
 #include <linux/futex.h>
 #include <linux/fcntl.h>
 #include <linux/if_packet.h>
+#include <linux/capability.h>
 #include <linux/ioctl.h>
 #include <linux/mman.h>
 #include <linux/net.h>
@@ -68,12 +69,14 @@
 #include <linux/quota.h>
 #include <linux/resource.h>
 #include <linux/stat.h>
+#include <linux/sysinfo.h>
 #include <linux/socket.h>
 #include <linux/stat.h>
 #include <linux/time.h>
 #include <linux/types.h>
 #include <linux/uio.h>
 #include <linux/un.h>
+#include <linux/utsname.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <syscall.h>
@@ -89,6 +92,10 @@
 #define SOL_NETLINK 270
 #endif
 
+#ifndef AF_UNIX
+#define AF_UNIX 1
+#endif
+
 #ifndef BTRFS_IOCTL_MAGIC
 #define BTRFS_IOCTL_MAGIC 0x94
 #endif
@@ -106,6 +113,10 @@ struct btrfs_ioctl_clone_range_args {
 #define MADV_FREE 8
 #endif
 
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
 #ifndef GRND_NONBLOCK
 #define GRND_NONBLOCK 1
 #endif
@@ -984,6 +995,7 @@ static void __attribute__((constructor)) init_process(void) {
 
   globals.breakpoint_value = (uint64_t)-1;
   globals.fdt_uniform = 1;
+  globals.single_task = 1;
   params.breakpoint_instr_addr = &do_breakpoint_fault_addr;
   params.breakpoint_mode_sentinel = -1;
   params.syscallbuf_syscall_hook = (void*)syscall_hook;
@@ -1589,6 +1601,46 @@ static long sys_generic_nonblocking_fd(struct syscall_info* call) {
   return commit_raw_syscall(call->no, ptr, ret);
 }
 
+/**
+ * Call this for syscalls that don't block and whose only memory effect is
+ * writing an outparam of up to |size| bytes pointed to by argument
+ * |out_arg|. If |ret_unit| is nonzero the syscall writes |ret_unit| bytes
+ * per unit of its return value, otherwise all |size| bytes on success.
+ */
+static long sys_generic_getter(struct syscall_info* call, int out_arg,
+                               size_t size, size_t ret_unit) {
+  void* out = (void*)call->args[out_arg];
+  long args[6];
+  void* ptr = prep_syscall();
+  void* out2 = NULL;
+  size_t out_size = 0;
+  long ret;
+  int i;
+
+  for (i = 0; i < 6; ++i) {
+    args[i] = call->args[i];
+  }
+  /* If |out| is null, pass it through so the kernel returns EFAULT. */
+  if (out && size > 0) {
+    out2 = ptr;
+    ptr += size;
+    args[out_arg] = (long)out2;
+  }
+  if (!start_commit_buffered_syscall(call->no, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  ret = untraced_syscall6(call->no, args[0], args[1], args[2], args[3],
+                          args[4], args[5]);
+  if (ret >= 0) {
+    out_size = ret_unit ? ret * ret_unit : size;
+    if (out_size > size) {
+      out_size = size;
+    }
+  }
+  ptr = copy_output_buffer(out_size, ptr, out, out2);
+  return commit_raw_syscall(call->no, ptr, ret);
+}
+
 /**
  * Call this for syscalls that have no memory effects, don't block, and
  * have an fd as their first parameter, and should run privileged.
@@ -1663,6 +1715,71 @@ static long sys_clock_gettime64(struct syscall_info* call) {
 }
 #endif
 
+/**
+ * nanosleep and clock_nanosleep only write the remaining time when they're
+ * interrupted by a signal, so copy it out only in that case.
+ */
+static long sys_generic_nanosleep(struct syscall_info* call, int req_arg) {
+  const int syscallno = call->no;
+  const struct timespec* req = (const struct timespec*)call->args[req_arg];
+  struct timespec* rem = (struct timespec*)call->args[req_arg + 1];
+  int flags = req_arg > 0 ? (int)call->args[1] : 0;
+  /* Don't read |req| here; an invalid pointer must get EFAULT from the
+     kernel. Arming the desched event costs nothing unless the sleep really
+     blocks, and then it hands the sleep over to rr. */
+
+  void* ptr = prep_syscall();
+  struct timespec* rem2 = NULL;
+  long ret;
+
+  /* The kernel ignores 'rem' for absolute sleeps. */
+  if (rem && !(flags & TIMER_ABSTIME)) {
+    rem2 = ptr;
+    ptr += sizeof(*rem2);
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  if (req_arg > 0) {
+    ret = untraced_syscall4(syscallno, call->args[0], flags, req, rem2);
+  } else {
+    ret = untraced_syscall2(syscallno, req, rem2);
+  }
+  ptr = copy_output_buffer(ret == -EINTR ? (long)sizeof(*rem2) : 0, ptr, rem,
+                           rem2);
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
+static long sys_clock_nanosleep(struct syscall_info* call) {
+  return sys_generic_nanosleep(call, 2);
+}
+
+#if defined(SYS_nanosleep)
+static long sys_nanosleep(struct syscall_info* call) {
+  return sys_generic_nanosleep(call, 0);
+}
+#endif
+
+static long sys_sched_yield(struct syscall_info* call) {
+  const int syscallno = SYS_sched_yield;
+  void* ptr;
+  long ret;
+
+  /* When other tasks share our address space, a spinning thread is usually
+     waiting for one of them, and only a traced sched_yield lets rr's
+     scheduler switch to it. */
+  if (!globals.single_task) {
+    return traced_raw_syscall(call);
+  }
+
+  ptr = prep_syscall();
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  ret = untraced_syscall0(syscallno);
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
 #if defined(SYS_creat)
 static long sys_open(struct syscall_info* call);
 static long sys_creat(struct syscall_info* call) {
@@ -1874,56 +1991,71 @@ static long sys_flistxattr(struct syscall_info* call) {
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
-static long sys_safe_nonblocking_ioctl(struct syscall_info* call) {
+enum {
+  SYSCALLBUF_IOCTL_NONE = 0,
+  SYSCALLBUF_IOCTL_IN = 1 << 0,
+  SYSCALLBUF_IOCTL_OUT = 1 << 1,
+  SYSCALLBUF_IOCTL_INOUT = SYSCALLBUF_IOCTL_IN | SYSCALLBUF_IOCTL_OUT,
+};
+enum {
+  SYSCALLBUF_IOCTL_QUERY,
+  SYSCALLBUF_IOCTL_FD_STATE,
+  SYSCALLBUF_IOCTL_DEVICE_STATE,
+  SYSCALLBUF_IOCTL_MAY_BLOCK,
+};
+struct syscallbuf_ioctl {
+  uint32_t request;
+  uint8_t direction;
+  uint8_t effect;
+  uint16_t size;
+};
+/* The ioctls we buffer; see ioctls.py. */
+static const struct syscallbuf_ioctl syscallbuf_ioctls[] = {
+#include "SyscallbufIoctls.generated"
+};
+
+static long sys_ioctl(struct syscall_info* call) {
   const int syscallno = SYS_ioctl;
   int fd = call->args[0];
-
-  void* ptr = prep_syscall_for_fd(fd);
+  void* arg = (void*)call->args[2];
+  const struct syscallbuf_ioctl* desc = NULL;
+  void* buf = NULL;
+  void* ptr;
   long ret;
+  size_t i;
 
-  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+  for (i = 0; i < sizeof(syscallbuf_ioctls) / sizeof(syscallbuf_ioctls[0]);
+       ++i) {
+    if (syscallbuf_ioctls[i].request == (uint32_t)call->args[1]) {
+      desc = &syscallbuf_ioctls[i];
+      break;
+    }
+  }
+  if (!desc) {
     return traced_raw_syscall(call);
   }
-  ret = untraced_syscall3(syscallno, fd, call->args[1], call->args[2]);
-  return commit_raw_syscall(syscallno, ptr, ret);
-}
-
-static long sys_ioctl_fionread(struct syscall_info* call) {
-  const int syscallno = SYS_ioctl;
-  int fd = call->args[0];
-  int* value = (int*)call->args[2];
-  void* buf = NULL;
-
-  void* ptr = prep_syscall_for_fd(fd);
-  long ret;
 
-  if (value) {
+  ptr = prep_syscall_for_fd(fd);
+  if (arg && (desc->direction & SYSCALLBUF_IOCTL_OUT)) {
     buf = ptr;
-    ptr += sizeof(*value);
+    ptr += desc->size;
   }
-  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+  if (!start_commit_buffered_syscall(
+          syscallno, ptr,
+          desc->effect == SYSCALLBUF_IOCTL_MAY_BLOCK ? MAY_BLOCK
+                                                     : WONT_BLOCK)) {
     return traced_raw_syscall(call);
   }
-  ret = untraced_syscall3(syscallno, fd, FIONREAD, buf);
+  if (buf && (desc->direction & SYSCALLBUF_IOCTL_IN)) {
+    memcpy_input_parameter(buf, arg, desc->size);
+  }
+  ret = untraced_syscall3(syscallno, fd, call->args[1], (buf ? buf : arg));
   if (buf && ret >= 0 && !buffer_hdr()->failed_during_preparation) {
-    local_memcpy(value, buf, sizeof(*value));
+    local_memcpy(arg, buf, desc->size);
   }
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
-static long sys_ioctl(struct syscall_info* call) {
-  switch (call->args[1]) {
-    case BTRFS_IOC_CLONE_RANGE:
-    case FIOCLEX:
-    case FIONCLEX:
-      return sys_safe_nonblocking_ioctl(call);
-    case FIONREAD:
-      return sys_ioctl_fionread(call);
-    default:
-      return traced_raw_syscall(call);
-  }
-}
-
 static long sys_futex(struct syscall_info* call) {
   enum {
     FUTEX_USES_UADDR2 = 1 << 0,
@@ -2313,6 +2445,132 @@ static long sys_mprotect(struct syscall_info* call) {
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
+/**
+ * The arguments a buffered mmap actually passes to the kernel. During
+ * recording these are the caller's; afterward we overwrite them with the
+ * address the kernel picked, so that during replay the mapping is recreated
+ * at the same address.
+ */
+struct mmap_arguments {
+  uint64_t addr;
+  uint64_t length;
+  int64_t flags;
+};
+
+static long sys_mmap(struct syscall_info* call) {
+  const int syscallno = call->no;
+  void* addr = (void*)call->args[0];
+  size_t length = call->args[1];
+  int prot = call->args[2];
+  int flags = call->args[3];
+  struct mmap_arguments args;
+  struct mmap_arguments* args2;
+  struct mprotect_record* mrec;
+
+  void* ptr;
+  long ret;
+
+  /* Only private anonymous mappings. Everything else needs rr to look at
+     the mapping (and chaos mode wants to pick the address). */
+  if (flags != (MAP_PRIVATE | MAP_ANONYMOUS) ||
+      (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) || globals.in_chaos ||
+      !buffer_hdr() ||
+      buffer_hdr()->mprotect_record_count >= MPROTECT_RECORD_COUNT) {
+    return traced_raw_syscall(call);
+  }
+
+  ptr = prep_syscall();
+  args2 = ptr;
+  ptr += sizeof(*args2);
+
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+
+  args.addr = (uint64_t)(uintptr_t)addr;
+  args.length = length;
+  args.flags = flags;
+  memcpy_input_parameter(args2, &args, sizeof(args));
+
+  ret = untraced_replayed_syscall6(syscallno, (uintptr_t)args2->addr,
+                                   (size_t)args2->length, prot,
+                                   (int)args2->flags, call->args[4],
+                                   call->args[5]);
+  args.addr = (uint64_t)(uintptr_t)ret;
+  args.flags = flags | MAP_FIXED_NOREPLACE;
+  if ((unsigned long)ret > (unsigned long)-4096) {
+    /* make sure replay doesn't map anything either */
+    args.length = 0;
+  }
+  local_memcpy(args2, &args, sizeof(args));
+
+  /* Unlike mprotect, rr can't tell whether an mmap has happened yet from the
+     record alone, so only publish the record once it has. */
+  mrec = &globals.mprotect_records[buffer_hdr()->mprotect_record_count];
+  mrec->start = (uint64_t)(uintptr_t)ret;
+  /* A size of zero indicates that nothing was mapped */
+  mrec->size = args.length;
+  mrec->prot = prot;
+  mrec->kind = MPROTECT_RECORD_MMAP;
+  buffer_hdr()->mprotect_record_count++;
+  buffer_hdr()->mprotect_record_count_completed++;
+
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
+/**
+ * Returns nonzero if [addr, addr + length) overlaps memory the syscallbuf
+ * code itself runs on: the rr page, the thread-locals page or this thread's
+ * buffer. Unmapping those has to go through rr.
+ */
+static int overlaps_preload_memory(void* addr, size_t length) {
+  uintptr_t start = (uintptr_t)addr;
+  uintptr_t end = start + length;
+  uintptr_t buf = (uintptr_t)thread_locals->buffer;
+  return end < start ||
+         (start < PRELOAD_THREAD_LOCALS_ADDR + PRELOAD_LIBRARY_PAGE_SIZE &&
+          end > RR_PAGE_ADDR) ||
+         (start < buf + thread_locals->buffer_size && end > buf);
+}
+
+static long sys_munmap(struct syscall_info* call) {
+  const int syscallno = SYS_munmap;
+  void* addr = (void*)call->args[0];
+  size_t length = call->args[1];
+  struct mprotect_record* mrec;
+
+  void* ptr;
+  long ret;
+
+  if (!buffer_hdr() ||
+      buffer_hdr()->mprotect_record_count >= MPROTECT_RECORD_COUNT ||
+      overlaps_preload_memory(addr, length)) {
+    return traced_raw_syscall(call);
+  }
+
+  ptr = prep_syscall();
+
+  assert(syscallno == call->no);
+
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+
+  ret = untraced_replayed_syscall2(syscallno, addr, length);
+
+  /* See sys_mmap. */
+  mrec = &globals.mprotect_records[buffer_hdr()->mprotect_record_count];
+  mrec->start = (uint64_t)(uintptr_t)addr;
+  /* A size of zero indicates that nothing was unmapped */
+  mrec->size = ret < 0 ? 0 : length;
+  mrec->prot = 0;
+  mrec->kind = MPROTECT_RECORD_MUNMAP;
+  buffer_hdr()->mprotect_record_count++;
+  buffer_hdr()->mprotect_record_count_completed++;
+
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
 static int supported_open(const char* file_name, int flags) {
   if (is_gcrypt_deny_file(file_name)) {
     /* This needs to be a traced syscall. We want to return an
@@ -2582,20 +2840,48 @@ static long sys_epoll_wait(struct syscall_info* call) {
   int epfd = call->args[0];
   struct epoll_event* events = (struct epoll_event*)call->args[1];
   int max_events = call->args[2];
-  int timeout = call->args[3];
+  int may_block = (int)call->args[3] != 0;
+  long timeout0 = 0;
 
   void* ptr;
   struct epoll_event* events2 = NULL;
   long ret;
 
+  if (SYS_epoll_pwait == call->no
+#if defined(SYS_epoll_pwait2)
+      || SYS_epoll_pwait2 == call->no
+#endif
+  ) {
+    if (call->args[4]) {
+      // See ppoll_deliver. Calls that temporarily change the sigmask are
+      // hard to handle; we may get a signal that we can't deliver later
+      // because it's blocked by the application.
+      return traced_raw_syscall(call);
+    }
+  }
+
   ptr = prep_syscall();
 
   assert(SYS_epoll_pwait == call->no
 #if defined(SYS_epoll_wait)
         || SYS_epoll_wait == call->no
+#endif
+#if defined(SYS_epoll_pwait2)
+        || SYS_epoll_pwait2 == call->no
 #endif
   );
 
+#if defined(SYS_epoll_pwait2)
+  /* epoll_pwait2 takes a timespec instead of milliseconds. */
+  const struct __kernel_timespec tmo0 = { 0, 0 };
+  if (SYS_epoll_pwait2 == call->no) {
+    const struct __kernel_timespec* tmo =
+        (const struct __kernel_timespec*)call->args[3];
+    may_block = !tmo || tmo->tv_sec || tmo->tv_nsec;
+    timeout0 = (long)&tmo0;
+  }
+#endif
+
   if (events && max_events > 0) {
     events2 = ptr;
     ptr += max_events * sizeof(*events2);
@@ -2611,12 +2897,12 @@ static long sys_epoll_wait(struct syscall_info* call) {
      rrcall_notify_syscall_hook_exit that gets triggered.
      N.B.: SYS_epoll_wait only has four arguments, but we don't care
      if the last two arguments are garbage */
-  ret = untraced_syscall6(call->no, epfd, events2, max_events, 0,
+  ret = untraced_syscall6(call->no, epfd, events2, max_events, timeout0,
     call->args[4], call->args[5]);
 
   ptr = copy_output_buffer(ret * sizeof(*events2), ptr, events, events2);
   ret = commit_raw_syscall(call->no, ptr, ret);
-  if (timeout == 0 || (ret != EINTR && ret != 0)) {
+  if (!may_block || (ret != -EINTR && ret != 0)) {
     /* If we got some real results, or a non-EINTR error, we can just
        return it directly.
        If we got no results and the timeout was 0, we can just return 0.
@@ -2645,8 +2931,167 @@ static long sys_epoll_wait(struct syscall_info* call) {
   return traced_raw_syscall(call);
 }
 
+/* The number of bytes of each fd_set the kernel reads and writes. */
+#define FD_SET_BYTES(nfds)                                                     \
+  ((((nfds) + 8 * sizeof(long) - 1) / (8 * sizeof(long))) * sizeof(long))
+
+/**
+ * select and pselect6. Like poll, we first try a no-timeout version of the
+ * syscall and only do a traced syscall if that finds nothing and the caller
+ * wanted to wait. The kernel updates the timeout with the time remaining;
+ * since the untraced syscall doesn't sleep, we leave it untouched.
+ */
+static long sys_generic_select(struct syscall_info* call) {
+  const int syscallno = call->no;
+  int nfds = call->args[0];
+  void* sets[3] = { (void*)call->args[1], (void*)call->args[2],
+                    (void*)call->args[3] };
+  void* sets2[3] = { NULL, NULL, NULL };
+  size_t size;
+  void* ptr;
+  long ret;
+  int i;
+
+  /* The kernel clamps nfds to the size of the fd table; don't make
+     oversized calls overflow our buffer size arithmetic. */
+  if (nfds < 0 || nfds > (1 << 20)) {
+    return traced_raw_syscall(call);
+  }
+  size = FD_SET_BYTES(nfds);
+
+  /* The sixth pselect6 argument points to a { sigset pointer, sigset size }
+     pair. We can't safely read it here, so let rr handle any call that
+     passes one; see sys_ppoll. glibc's select passes NULL. Likewise we don't
+     read the timeout, so assume the call may block whenever nothing is ready
+     yet. */
+  if (SYS_pselect6 == syscallno && call->args[5]) {
+    return traced_raw_syscall(call);
+  }
+
+  ptr = prep_syscall();
+  for (i = 0; i < 3; ++i) {
+    if (sets[i] && size > 0) {
+      sets2[i] = ptr;
+      ptr += size;
+    }
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  for (i = 0; i < 3; ++i) {
+    if (sets2[i]) {
+      memcpy_input_parameter(sets2[i], sets[i], size);
+    }
+  }
+
+  if (SYS_pselect6 == syscallno) {
+    struct timespec tmo0 = { 0, 0 };
+    ret = untraced_syscall6(syscallno, nfds, sets2[0], sets2[1], sets2[2],
+                            &tmo0, 0);
+  } else {
+    struct timeval tmo0 = { 0, 0 };
+    ret = untraced_syscall5(syscallno, nfds, sets2[0], sets2[1], sets2[2],
+                            &tmo0);
+  }
+
+  if (ret > 0 && !buffer_hdr()->failed_during_preparation) {
+    /* Only copy out a result we're going to return. If nothing was ready
+       the traced call below needs the caller's sets intact. Don't copy on
+       error; see sys_ppoll. */
+    for (i = 0; i < 3; ++i) {
+      if (sets2[i]) {
+        local_memcpy(sets[i], sets2[i], size);
+      }
+    }
+  }
+  ret = commit_raw_syscall(syscallno, ptr, ret);
+
+  if (ret != -EINTR && ret != 0) {
+    return ret;
+  }
+  /* See sys_epoll_wait. */
+  return traced_raw_syscall(call);
+}
+
 #define CLONE_SIZE_THRESHOLD 0x10000
 
+/**
+ * Try cloning |count| bytes at |fd|'s current offset into
+ * cloned_file_data_fd, so that a read of that data from |fd| can be replayed
+ * by reading the clone instead of storing the data in the syscallbuf.
+ * Returns 1 on success. The caller must then read |fd| with an
+ * untraced_replayed syscall, and call replay_only_syscall1(SYS_close, fd)
+ * before committing it.
+ *
+ * We use the CLONE_RANGE ioctl.
+ * XXX switch to FIOCLONERANGE when that's more widely available. It's the
+ * same ioctl number so it won't affect rr per se but it'd be cleaner code.
+ * 64-bit only for now, since lseek and pread64 need special handling for
+ * 32-bit.
+ * Basically we break down the read into three syscalls lseek, clone and
+ * read-from-clone, each of which is individually syscall-buffered.
+ * Crucially, the read-from-clone syscall does NOT store data in the syscall
+ * buffer; instead, we perform the syscall during replay, assuming that
+ * cloned_file_data_fd is open to the same file during replay.
+ * Reads that hit EOF are rejected by the CLONE_RANGE ioctl so we take the
+ * slow path. That's OK.
+ * There is a possible race here: between cloning the data and reading from
+ * |fd|, |fd|'s data may be overwritten, in which case the data read during
+ * replay will not match the data read during recording, causing divergence.
+ * I don't see any performant way to avoid this race; I tried reading from
+ * the cloned data instead of |fd|, but that is very slow because readahead
+ * doesn't work. (The cloned data file always ends at the current offset so
+ * there is nothing to readahead.) However, if an application triggers this
+ * race, it's almost certainly a bad bug because Linux can return any
+ * interleaving of old+new data for the read even without rr.
+ */
+static int start_cloned_read(int fd, size_t count) {
+  if (count < CLONE_SIZE_THRESHOLD ||
+      thread_locals->cloned_file_data_fd < 0 || !is_bufferable_fd(fd) ||
+      sizeof(void*) != 8 || (count & 4095)) {
+    return 0;
+  }
+
+  struct syscall_info lseek_call = { SYS_lseek,
+                                     { fd, 0, SEEK_CUR, 0, 0, 0 } };
+  off_t lseek_ret = privileged_sys_generic_nonblocking_fd(&lseek_call);
+  if (lseek_ret < 0 || (lseek_ret & 4095)) {
+    return 0;
+  }
+
+  struct btrfs_ioctl_clone_range_args ioctl_args;
+  int ioctl_ret;
+  void* ioctl_ptr = prep_syscall();
+  ioctl_args.src_fd = fd;
+  ioctl_args.src_offset = lseek_ret;
+  ioctl_args.src_length = count;
+  ioctl_args.dest_offset = thread_locals->cloned_file_data_offset;
+
+  /* Don't call sys_ioctl here; cloned_file_data_fd has syscall buffering
+   * disabled for it so rr can reject attempts to close/dup to it. But
+   * we want to allow syscall buffering of this ioctl on it.
+   */
+  if (!start_commit_buffered_syscall(SYS_ioctl, ioctl_ptr, WONT_BLOCK)) {
+    struct syscall_info ioctl_call = { SYS_ioctl,
+                                       { thread_locals->cloned_file_data_fd,
+                                         BTRFS_IOC_CLONE_RANGE,
+                                         (long)&ioctl_args, 0, 0, 0 } };
+    ioctl_ret = privileged_traced_raw_syscall(&ioctl_call);
+  } else {
+    ioctl_ret =
+        privileged_untraced_syscall3(SYS_ioctl, thread_locals->cloned_file_data_fd,
+                                     BTRFS_IOC_CLONE_RANGE, &ioctl_args);
+    ioctl_ret = commit_raw_syscall(SYS_ioctl, ioctl_ptr, ioctl_ret);
+  }
+  if (ioctl_ret < 0) {
+    return 0;
+  }
+
+  thread_locals->cloned_file_data_offset += count;
+  replay_only_syscall3(SYS_dup3, thread_locals->cloned_file_data_fd, fd, 0);
+  return 1;
+}
+
 static long sys_read(struct syscall_info* call) {
   if (force_traced_syscall_for_chaos_mode()) {
     /* Reading from a pipe could unblock a higher priority task */
@@ -2662,90 +3107,30 @@ static long sys_read(struct syscall_info* call) {
   void* buf2 = NULL;
   long ret;
 
-  /* Try cloning data using CLONE_RANGE ioctl.
-   * XXX switch to FIOCLONERANGE when that's more widely available. It's the
-   * same ioctl number so it won't affect rr per se but it'd be cleaner code.
-   * 64-bit only for now, since lseek and pread64 need special handling for
-   * 32-bit.
-   * Basically we break down the read into three syscalls lseek, clone and
-   * read-from-clone, each of which is individually syscall-buffered.
-   * Crucially, the read-from-clone syscall does NOT store data in the syscall
-   * buffer; instead, we perform the syscall during replay, assuming that
-   * cloned_file_data_fd is open to the same file during replay.
-   * Reads that hit EOF are rejected by the CLONE_RANGE ioctl so we take the
-   * slow path. That's OK.
-   * There is a possible race here: between cloning the data and reading from
-   * |fd|, |fd|'s data may be overwritten, in which case the data read during
-   * replay will not match the data read during recording, causing divergence.
-   * I don't see any performant way to avoid this race; I tried reading from
-   * the cloned data instead of |fd|, but that is very slow because readahead
-   * doesn't work. (The cloned data file always ends at the current offset so
-   * there is nothing to readahead.) However, if an application triggers this
-   * race, it's almost certainly a bad bug because Linux can return any
-   * interleaving of old+new data for the read even without rr.
-   */
-  if (buf && count >= CLONE_SIZE_THRESHOLD &&
-      thread_locals->cloned_file_data_fd >= 0 && is_bufferable_fd(fd) &&
-      sizeof(void*) == 8 && !(count & 4095)) {
-    struct syscall_info lseek_call = { SYS_lseek,
-                                       { fd, 0, SEEK_CUR, 0, 0, 0 } };
-    off_t lseek_ret = privileged_sys_generic_nonblocking_fd(&lseek_call);
-    if (lseek_ret >= 0 && !(lseek_ret & 4095)) {
-      struct btrfs_ioctl_clone_range_args ioctl_args;
-      int ioctl_ret;
-      void* ioctl_ptr = prep_syscall();
-      ioctl_args.src_fd = fd;
-      ioctl_args.src_offset = lseek_ret;
-      ioctl_args.src_length = count;
-      ioctl_args.dest_offset = thread_locals->cloned_file_data_offset;
-
-      /* Don't call sys_ioctl here; cloned_file_data_fd has syscall buffering
-       * disabled for it so rr can reject attempts to close/dup to it. But
-       * we want to allow syscall buffering of this ioctl on it.
-       */
-      if (!start_commit_buffered_syscall(SYS_ioctl, ioctl_ptr, WONT_BLOCK)) {
-        struct syscall_info ioctl_call = { SYS_ioctl,
-                                           { thread_locals->cloned_file_data_fd,
-                                             BTRFS_IOC_CLONE_RANGE,
-                                             (long)&ioctl_args, 0, 0, 0 } };
-        ioctl_ret = privileged_traced_raw_syscall(&ioctl_call);
-      } else {
-        ioctl_ret =
-            privileged_untraced_syscall3(SYS_ioctl, thread_locals->cloned_file_data_fd,
-                                         BTRFS_IOC_CLONE_RANGE, &ioctl_args);
-        ioctl_ret = commit_raw_syscall(SYS_ioctl, ioctl_ptr, ioctl_ret);
+  if (buf && start_cloned_read(fd, count)) {
+    struct syscall_info read_call = { SYS_read,
+                                      { fd, (long)buf, count, 0, 0, 0 } };
+    ptr = prep_syscall();
+    if (count > thread_locals->usable_scratch_size) {
+      if (!start_commit_buffered_syscall(SYS_read, ptr, WONT_BLOCK)) {
+        return traced_raw_syscall(&read_call);
       }
-
-      if (ioctl_ret >= 0) {
-        struct syscall_info read_call = { SYS_read,
-                                          { fd, (long)buf, count, 0, 0, 0 } };
-        thread_locals->cloned_file_data_offset += count;
-
-        replay_only_syscall3(SYS_dup3, thread_locals->cloned_file_data_fd, fd, 0);
-
-        ptr = prep_syscall();
-        if (count > thread_locals->usable_scratch_size) {
-          if (!start_commit_buffered_syscall(SYS_read, ptr, WONT_BLOCK)) {
-            return traced_raw_syscall(&read_call);
-          }
-          ret = untraced_replayed_syscall3(SYS_read, fd, buf, count);
-        } else {
-          if (!start_commit_buffered_syscall(SYS_read, ptr, MAY_BLOCK)) {
-            return traced_raw_syscall(&read_call);
-          }
-          ret = untraced_replayed_syscall3(SYS_read, fd,
-                                           thread_locals->scratch_buf, count);
-          copy_output_buffer(ret, NULL, buf, thread_locals->scratch_buf);
-        }
-        // Do this now before we finish processing the syscallbuf record.
-        // This means the syscall will be executed in
-        // ReplaySession::flush_syscallbuf instead of
-        // ReplaySession::enter_syscall or something similar.
-        replay_only_syscall1(SYS_close, fd);
-        ret = commit_raw_syscall(SYS_read, ptr, ret);
-        return ret;
+      ret = untraced_replayed_syscall3(SYS_read, fd, buf, count);
+    } else {
+      if (!start_commit_buffered_syscall(SYS_read, ptr, MAY_BLOCK)) {
+        return traced_raw_syscall(&read_call);
       }
+      ret = untraced_replayed_syscall3(SYS_read, fd,
+                                       thread_locals->scratch_buf, count);
+      copy_output_buffer(ret, NULL, buf, thread_locals->scratch_buf);
     }
+    // Do this now before we finish processing the syscallbuf record.
+    // This means the syscall will be executed in
+    // ReplaySession::flush_syscallbuf instead of
+    // ReplaySession::enter_syscall or something similar.
+    replay_only_syscall1(SYS_close, fd);
+    ret = commit_raw_syscall(SYS_read, ptr, ret);
+    return ret;
   }
 
   ptr = prep_syscall_for_fd(fd);
@@ -2798,32 +3183,143 @@ static long sys_pread64(struct syscall_info* call) {
 }
 #endif
 
-#if defined(SYS_readlink)
-static long sys_readlink(struct syscall_info* call) {
-  const int syscallno = SYS_readlink;
-  const char* path = (const char*)call->args[0];
-  char* buf = (char*)call->args[1];
-  int bufsiz = call->args[2];
+/**
+ * Returns the total length of the |iovcnt| buffers in |iov|, or -1 if the
+ * kernel would reject them (in which case we let a traced syscall report
+ * the error).
+ */
+static ssize_t iovec_total_length(const struct iovec* iov, long iovcnt) {
+  ssize_t total = 0;
+  long i;
+  if (iovcnt < 0 || iovcnt > UIO_MAXIOV) {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; ++i) {
+    if ((ssize_t)iov[i].iov_len < 0 ||
+        (ssize_t)iov[i].iov_len > SSIZE_MAX - total) {
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  return total;
+}
 
-  void* ptr = prep_syscall();
-  char* buf2 = NULL;
-  long ret;
+/**
+ * Handles readv, preadv and preadv2. The output is read into a contiguous
+ * buffer in the syscallbuf and then scattered to the caller's iovecs; a
+ * short read fills them in order.
+ */
+static long sys_generic_readv(struct syscall_info* call) {
+  const int syscallno = call->no;
+  int fd = call->args[0];
+  const struct iovec* iov = (const struct iovec*)call->args[1];
+  long iovcnt = call->args[2];
 
-  assert(syscallno == call->no);
+  void* ptr;
+  void* ptr_base;
+  void* ptr_overwritten_end;
+  void* ptr_bytes_start;
+  struct iovec* iov2;
+  ssize_t count;
+  long ret;
+  long i;
 
-  if (buf && bufsiz > 0) {
-    buf2 = ptr;
-    ptr += bufsiz;
-  }
-  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+  if (syscallno == SYS_readv && force_traced_syscall_for_chaos_mode()) {
+    /* Reading from a pipe could unblock a higher priority task */
     return traced_raw_syscall(call);
   }
 
-  ret = untraced_syscall3(syscallno, path, buf2, bufsiz);
-  ptr = copy_output_buffer(ret, ptr, buf, buf2);
-  return commit_raw_syscall(syscallno, ptr, ret);
-}
-#endif
+  count = iovec_total_length(iov, iovcnt);
+  if (count < 0) {
+    return traced_raw_syscall(call);
+  }
+
+  /* Large reads at the file offset can be replayed from a clone of the
+   * file data, like sys_read. The data goes straight to the caller's
+   * buffers; nothing is stored in the syscallbuf. */
+  if (syscallno == SYS_readv && start_cloned_read(fd, count)) {
+    ptr = prep_syscall();
+    if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+      return traced_raw_syscall(call);
+    }
+    ret = untraced_replayed_syscall3(syscallno, fd, iov, iovcnt);
+    replay_only_syscall1(SYS_close, fd);
+    return commit_raw_syscall(syscallno, ptr, ret);
+  }
+
+  ptr = prep_syscall_for_fd(fd);
+  ptr_base = ptr;
+
+  assert(syscallno == call->no);
+
+  /* Compute final buffer size up front, before writing syscall inputs to the
+   * buffer. See sys_recvmsg.
+   */
+  ptr += sizeof(struct iovec) * iovcnt + count;
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+
+  /* The kernel doesn't write to the iovecs themselves, so plain assignment
+   * is fine here; we write the same values during replay. */
+  iov2 = ptr = ptr_base;
+  ptr += sizeof(struct iovec) * iovcnt;
+  ptr_overwritten_end = ptr;
+  ptr_bytes_start = ptr;
+  for (i = 0; i < iovcnt; ++i) {
+    iov2[i].iov_base = ptr;
+    iov2[i].iov_len = iov[i].iov_len;
+    ptr += iov[i].iov_len;
+  }
+
+  /* readv ignores the extra arguments */
+  ret = untraced_syscall6(syscallno, fd, iov2, iovcnt, call->args[3],
+                          call->args[4], call->args[5]);
+
+  if (ret >= 0 && !buffer_hdr()->failed_during_preparation) {
+    size_t bytes = ret;
+    void* src = ptr_bytes_start;
+    for (i = 0; i < iovcnt && bytes > 0; ++i) {
+      size_t copy_bytes =
+          bytes < iov[i].iov_len ? bytes : iov[i].iov_len;
+      local_memcpy(iov[i].iov_base, src, copy_bytes);
+      src += copy_bytes;
+      bytes -= copy_bytes;
+    }
+    ptr = ptr_bytes_start + ret;
+  } else {
+    /* Cover the iovecs we wrote above; see sys_recvmsg. */
+    ptr = ptr_overwritten_end;
+  }
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
+#if defined(SYS_readlink)
+static long sys_readlink(struct syscall_info* call) {
+  const int syscallno = SYS_readlink;
+  const char* path = (const char*)call->args[0];
+  char* buf = (char*)call->args[1];
+  int bufsiz = call->args[2];
+
+  void* ptr = prep_syscall();
+  char* buf2 = NULL;
+  long ret;
+
+  assert(syscallno == call->no);
+
+  if (buf && bufsiz > 0) {
+    buf2 = ptr;
+    ptr += bufsiz;
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+
+  ret = untraced_syscall3(syscallno, path, buf2, bufsiz);
+  ptr = copy_output_buffer(ret, ptr, buf, buf2);
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+#endif
 
 static long sys_readlinkat(struct syscall_info* call, int privileged) {
   const int syscallno = SYS_readlinkat;
@@ -3016,6 +3512,81 @@ static int msg_received_file_descriptors(struct msghdr* msg) {
   return 0;
 }
 
+/**
+ * Space needed in the syscallbuf for everything the kernel writes through
+ * 'msg' apart from the struct msghdr itself and its iovec array.
+ */
+static size_t recvmsg_buffers_size(const struct msghdr* msg) {
+  size_t size = 0;
+  size_t i;
+  if (msg->msg_name) {
+    size += msg->msg_namelen;
+  }
+  if (msg->msg_control) {
+    size += msg->msg_controllen;
+  }
+  for (i = 0; i < msg->msg_iovlen; ++i) {
+    size += msg->msg_iov[i].iov_len;
+  }
+  return size;
+}
+
+/**
+ * Point the name, control and iovec buffers of 'msg2', a copy of 'msg' in
+ * the syscallbuf, at the space starting at 'ptr'. The iovec array itself
+ * must already be set up at msg2->msg_iov. Returns the end of the space.
+ * Sets *bytes_start to where the received data will start.
+ */
+static void* prep_recvmsg_buffers(struct msghdr* msg2, const struct msghdr* msg,
+                                  void* ptr, void** bytes_start) {
+  size_t i;
+  if (msg->msg_name) {
+    msg2->msg_name = ptr;
+    ptr += msg->msg_namelen;
+  }
+  if (msg->msg_control) {
+    msg2->msg_control = ptr;
+    ptr += msg->msg_controllen;
+  }
+  *bytes_start = ptr;
+  for (i = 0; i < msg->msg_iovlen; ++i) {
+    msg2->msg_iov[i].iov_base = ptr;
+    ptr += msg->msg_iov[i].iov_len;
+    msg2->msg_iov[i].iov_len = msg->msg_iov[i].iov_len;
+  }
+  return ptr;
+}
+
+/**
+ * Copy what the kernel wrote to 'msg2' for a message of 'bytes' bytes
+ * back to 'msg'.
+ */
+static void copy_recvmsg_output(struct msghdr* msg, const struct msghdr* msg2,
+                                size_t bytes) {
+  size_t i;
+  if (msg->msg_name) {
+    /* The kernel reports the full address length even if it had to
+       truncate the address. */
+    size_t name_bytes = (size_t)msg2->msg_namelen < (size_t)msg->msg_namelen
+                            ? (size_t)msg2->msg_namelen
+                            : (size_t)msg->msg_namelen;
+    local_memcpy(msg->msg_name, msg2->msg_name, name_bytes);
+  }
+  msg->msg_namelen = msg2->msg_namelen;
+  if (msg->msg_control) {
+    local_memcpy(msg->msg_control, msg2->msg_control, msg2->msg_controllen);
+  }
+  msg->msg_controllen = msg2->msg_controllen;
+  for (i = 0; i < msg->msg_iovlen; ++i) {
+    long copy_bytes =
+        bytes < msg->msg_iov[i].iov_len ? bytes : msg->msg_iov[i].iov_len;
+    local_memcpy(msg->msg_iov[i].iov_base, msg2->msg_iov[i].iov_base,
+                 copy_bytes);
+    bytes -= copy_bytes;
+  }
+  msg->msg_flags = msg2->msg_flags;
+}
+
 static long sys_recvmsg(struct syscall_info* call) {
   if (force_traced_syscall_for_chaos_mode()) {
     /* Reading from a socket could unblock a higher priority task */
@@ -3034,7 +3605,6 @@ static long sys_recvmsg(struct syscall_info* call) {
   void* ptr_overwritten_end;
   void* ptr_bytes_start;
   void* ptr_end;
-  size_t i;
 
   assert(syscallno == call->no);
 
@@ -3043,16 +3613,8 @@ static long sys_recvmsg(struct syscall_info* call) {
    * before trying to write to a buffer that won't be recorded and may be
    * invalid (e.g. overflow).
    */
-  ptr += sizeof(struct msghdr) + sizeof(struct iovec) * msg->msg_iovlen;
-  if (msg->msg_name) {
-    ptr += msg->msg_namelen;
-  }
-  if (msg->msg_control) {
-    ptr += msg->msg_controllen;
-  }
-  for (i = 0; i < msg->msg_iovlen; ++i) {
-    ptr += msg->msg_iov[i].iov_len;
-  }
+  ptr += sizeof(struct msghdr) + sizeof(struct iovec) * msg->msg_iovlen +
+         recvmsg_buffers_size(msg);
   if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
     return traced_raw_syscall(call);
   }
@@ -3072,43 +3634,13 @@ static long sys_recvmsg(struct syscall_info* call) {
   msg2->msg_iov = ptr;
   ptr += sizeof(struct iovec) * msg->msg_iovlen;
   ptr_overwritten_end = ptr;
-  if (msg->msg_name) {
-    msg2->msg_name = ptr;
-    ptr += msg->msg_namelen;
-  }
-  if (msg->msg_control) {
-    msg2->msg_control = ptr;
-    ptr += msg->msg_controllen;
-  }
-  ptr_bytes_start = ptr;
-  for (i = 0; i < msg->msg_iovlen; ++i) {
-    msg2->msg_iov[i].iov_base = ptr;
-    ptr += msg->msg_iov[i].iov_len;
-    msg2->msg_iov[i].iov_len = msg->msg_iov[i].iov_len;
-  }
+  prep_recvmsg_buffers(msg2, msg, ptr, &ptr_bytes_start);
 
   ret = untraced_syscall3(syscallno, sockfd, msg2, flags);
 
   if (ret >= 0 && !buffer_hdr()->failed_during_preparation) {
-    size_t bytes = ret;
-    size_t i;
-    if (msg->msg_name) {
-      local_memcpy(msg->msg_name, msg2->msg_name, msg2->msg_namelen);
-    }
-    msg->msg_namelen = msg2->msg_namelen;
-    if (msg->msg_control) {
-      local_memcpy(msg->msg_control, msg2->msg_control, msg2->msg_controllen);
-    }
-    msg->msg_controllen = msg2->msg_controllen;
-    ptr_end = ptr_bytes_start + bytes;
-    for (i = 0; i < msg->msg_iovlen; ++i) {
-      long copy_bytes =
-          bytes < msg->msg_iov[i].iov_len ? bytes : msg->msg_iov[i].iov_len;
-      local_memcpy(msg->msg_iov[i].iov_base, msg2->msg_iov[i].iov_base,
-                   copy_bytes);
-      bytes -= copy_bytes;
-    }
-    msg->msg_flags = msg2->msg_flags;
+    copy_recvmsg_output(msg, msg2, ret);
+    ptr_end = ptr_bytes_start + ret;
 
     if (msg_received_file_descriptors(msg)) {
       /* When we reach a safe point, notify rr that the control message with
@@ -3127,6 +3659,95 @@ static long sys_recvmsg(struct syscall_info* call) {
 }
 #endif
 
+#if defined(SYS_recvmmsg) || defined(SYS_sendmmsg)
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
+#ifdef SYS_recvmmsg
+/**
+ * Like sys_recvmsg, for each message of the batch. The syscallbuf copy is
+ * laid out as the mmsghdr array, then all the iovec arrays, then the name,
+ * control and data buffers of each message in turn, so when only some
+ * messages arrive we only need to record up to the last one of those.
+ */
+static long sys_recvmmsg(struct syscall_info* call) {
+  if (force_traced_syscall_for_chaos_mode()) {
+    /* Reading from a socket could unblock a higher priority task */
+    return traced_raw_syscall(call);
+  }
+
+  const int syscallno = call->no;
+  int sockfd = call->args[0];
+  struct mmsghdr* msgvec = (struct mmsghdr*)call->args[1];
+  unsigned int vlen = call->args[2];
+  int flags = call->args[3];
+  void* timeout = (void*)call->args[4];
+
+  void* ptr;
+  long ret;
+  struct mmsghdr* msgvec2;
+  void* ptr_base;
+  void* ptr_overwritten_end;
+  void* ptr_end;
+  void* bytes_start;
+  unsigned int i;
+
+  /* rr has to see the timeout expire. Control messages may carry file
+     descriptors, and we can only notify rr of one such message; see
+     sys_recvmsg. */
+  if (timeout || vlen == 0 || vlen > UIO_MAXIOV) {
+    return traced_raw_syscall(call);
+  }
+  for (i = 0; i < vlen; ++i) {
+    if (msgvec[i].msg_hdr.msg_control) {
+      return traced_raw_syscall(call);
+    }
+  }
+
+  ptr_base = ptr = prep_syscall_for_fd(sockfd);
+  ptr += sizeof(struct mmsghdr) * vlen;
+  for (i = 0; i < vlen; ++i) {
+    ptr += sizeof(struct iovec) * msgvec[i].msg_hdr.msg_iovlen +
+           recvmsg_buffers_size(&msgvec[i].msg_hdr);
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+
+  /* See sys_recvmsg for why the mmsghdrs are copied in this way. */
+  msgvec2 = ptr = ptr_base;
+  memcpy_input_parameter(msgvec2, msgvec, sizeof(*msgvec2) * vlen);
+  ptr += sizeof(*msgvec2) * vlen;
+  for (i = 0; i < vlen; ++i) {
+    msgvec2[i].msg_hdr.msg_iov = ptr;
+    ptr += sizeof(struct iovec) * msgvec[i].msg_hdr.msg_iovlen;
+  }
+  ptr_overwritten_end = ptr;
+  for (i = 0; i < vlen; ++i) {
+    ptr = prep_recvmsg_buffers(&msgvec2[i].msg_hdr, &msgvec[i].msg_hdr, ptr,
+                               &bytes_start);
+  }
+
+  ret = untraced_syscall5(syscallno, sockfd, msgvec2, vlen, flags, NULL);
+
+  ptr_end = ptr_overwritten_end;
+  if (ret > 0 && !buffer_hdr()->failed_during_preparation) {
+    for (i = 0; i < ret; ++i) {
+      /* The buffers were laid out using the caller's lengths, which
+         copy_recvmsg_output overwrites with the kernel's. */
+      ptr_end += recvmsg_buffers_size(&msgvec[i].msg_hdr);
+      copy_recvmsg_output(&msgvec[i].msg_hdr, &msgvec2[i].msg_hdr,
+                          msgvec2[i].msg_len);
+      msgvec[i].msg_len = msgvec2[i].msg_len;
+    }
+  }
+  return commit_raw_syscall(syscallno, ptr_end, ret);
+}
+#endif
+
 #ifdef SYS_sendmsg
 static long sys_sendmsg(struct syscall_info* call) {
   if (force_traced_syscall_for_chaos_mode()) {
@@ -3154,6 +3775,51 @@ static long sys_sendmsg(struct syscall_info* call) {
 }
 #endif
 
+#ifdef SYS_sendmmsg
+static long sys_sendmmsg(struct syscall_info* call) {
+  if (force_traced_syscall_for_chaos_mode()) {
+    /* Sending to a socket could unblock a higher priority task */
+    return traced_raw_syscall(call);
+  }
+
+  const int syscallno = SYS_sendmmsg;
+  int sockfd = call->args[0];
+  struct mmsghdr* msgvec = (struct mmsghdr*)call->args[1];
+  unsigned int vlen = call->args[2];
+  int flags = call->args[3];
+
+  void* ptr;
+  struct mmsghdr* msgvec2;
+  long ret;
+  long i;
+
+  assert(syscallno == call->no);
+
+  if (vlen == 0 || vlen > UIO_MAXIOV) {
+    return traced_raw_syscall(call);
+  }
+
+  /* The kernel writes msg_len of each message it sends, so give it a copy
+     of the mmsghdrs. */
+  ptr = prep_syscall_for_fd(sockfd);
+  msgvec2 = ptr;
+  ptr += sizeof(*msgvec2) * vlen;
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  memcpy_input_parameter(msgvec2, msgvec, sizeof(*msgvec2) * vlen);
+
+  ret = untraced_syscall4(syscallno, sockfd, msgvec2, vlen, flags);
+
+  if (ret > 0 && !buffer_hdr()->failed_during_preparation) {
+    for (i = 0; i < ret; ++i) {
+      msgvec[i].msg_len = msgvec2[i].msg_len;
+    }
+  }
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+#endif
+
 #ifdef SYS_sendto
 static long sys_sendto(struct syscall_info* call) {
   if (force_traced_syscall_for_chaos_mode()) {
@@ -3185,6 +3851,158 @@ static long sys_sendto(struct syscall_info* call) {
 }
 #endif
 
+#if defined(SYS_accept) || defined(SYS_accept4) || defined(SYS_connect)
+static const struct syscallbuf_socket_addrs empty_socket_addrs = {
+  sizeof(empty_socket_addrs.local), sizeof(empty_socket_addrs.remote), { 0 },
+  { 0 }
+};
+
+/**
+ * Save the addresses of the socket |fd| that a buffered accept or connect
+ * just connected, in a getpeername record of their own right after the
+ * accept/connect record (see syscallbuf_socket_addrs). This must run after
+ * the accept/connect record has been committed: while its desched event is
+ * armed, rr would take a desched during getsockname/getpeername to be the
+ * accept/connect blocking. The results aren't checked: rr only uses
+ * addresses whose family it knows, and during replay this does nothing.
+ */
+static void record_socket_addrs(int fd) {
+#if defined(SYS_getsockname) && defined(SYS_getpeername)
+  void* ptr = prep_syscall();
+  struct syscallbuf_socket_addrs* addrs2;
+  long ret;
+
+  addrs2 = ptr;
+  ptr += sizeof(*addrs2);
+  if (!start_commit_buffered_syscall(SYS_getpeername, ptr, WONT_BLOCK)) {
+    return;
+  }
+  memcpy_input_parameter(addrs2, (void*)&empty_socket_addrs, sizeof(*addrs2));
+  untraced_syscall3(SYS_getsockname, fd, addrs2->local, &addrs2->local_len);
+  ret = untraced_syscall3(SYS_getpeername, fd, addrs2->remote,
+                          &addrs2->remote_len);
+  commit_raw_syscall(SYS_getpeername, ptr, ret);
+#else
+  (void)fd;
+#endif
+}
+#endif
+
+#if defined(SYS_accept) || defined(SYS_accept4)
+static long sys_generic_accept(struct syscall_info* call) {
+  if (force_traced_syscall_for_chaos_mode()) {
+    /* Accepting a connection could unblock a higher priority task */
+    return traced_raw_syscall(call);
+  }
+
+  const int syscallno = call->no;
+  int sockfd = call->args[0];
+  /* See sys_recvfrom */
+  void* addr = (void*)call->args[1];
+  socklen_t* addrlen = (socklen_t*)call->args[2];
+  /* accept only has three arguments, but it doesn't matter if the fourth
+     is garbage. */
+  int flags = call->args[3];
+
+  if (addr && (!addrlen || (int)*addrlen < 0)) {
+    /* Let the kernel report the error. */
+    return traced_raw_syscall(call);
+  }
+
+  void* ptr = prep_syscall_for_fd(sockfd);
+  socklen_t* addrlen2 = NULL;
+  void* addr2 = NULL;
+  long ret;
+
+  if (addrlen) {
+    addrlen2 = ptr;
+    ptr += sizeof(*addrlen2);
+  }
+  if (addr) {
+    addr2 = ptr;
+    ptr += *addrlen;
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  if (addrlen) {
+    memcpy_input_parameter(addrlen2, addrlen, sizeof(*addrlen2));
+  }
+  ret = untraced_syscall4(syscallno, sockfd, addr2, addrlen2, flags);
+
+  if (ret >= 0 && !buffer_hdr()->failed_during_preparation) {
+    if (addr2) {
+      socklen_t actual_size = *addrlen2;
+      if (actual_size > *addrlen) {
+        actual_size = *addrlen;
+      }
+      local_memcpy(addr, addr2, actual_size);
+    }
+    if (addrlen2) {
+      *addrlen = *addrlen2;
+    }
+  }
+  ret = commit_raw_syscall(syscallno, ptr, ret);
+  if (ret >= 0) {
+    record_socket_addrs(ret);
+  }
+  return ret;
+}
+#endif
+
+#if defined(SYS_connect)
+static long sys_connect(struct syscall_info* call) {
+  if (force_traced_syscall_for_chaos_mode()) {
+    /* Connecting could unblock a higher priority task */
+    return traced_raw_syscall(call);
+  }
+
+  const int syscallno = SYS_connect;
+  int sockfd = call->args[0];
+  /* Only the family is common to all sockaddrs. */
+  const struct sockaddr_un* un = (const struct sockaddr_un*)call->args[1];
+  socklen_t addrlen = call->args[2];
+  int is_unix;
+
+  /* Let the kernel report invalid lengths before we read anything. */
+  if (!un || addrlen < sizeof(un->sun_family) ||
+      addrlen > sizeof(struct __kernel_sockaddr_storage)) {
+    return traced_raw_syscall(call);
+  }
+  is_unix = un->sun_family == AF_UNIX;
+  if (is_unix) {
+    /* rr refuses to connect to some sockets; see maybe_blacklist_connect. */
+    char path[sizeof(un->sun_path) + 1];
+    int path_len = (int)addrlen - (int)sizeof(un->sun_family);
+    if (path_len > (int)sizeof(un->sun_path)) {
+      path_len = sizeof(un->sun_path);
+    }
+    local_memset(path, 0, sizeof(path));
+    local_memcpy(path, un->sun_path, path_len);
+    if (is_blacklisted_socket(path)) {
+      return traced_raw_syscall(call);
+    }
+  }
+
+  void* ptr = prep_syscall_for_fd(sockfd);
+  long ret;
+
+  assert(syscallno == call->no);
+
+  if (!start_commit_buffered_syscall(syscallno, ptr, MAY_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  ret = untraced_syscall3(syscallno, sockfd, un, addrlen);
+  ret = commit_raw_syscall(syscallno, ptr, ret);
+  /* rr only records the addresses of IP connections. A nonblocking connect
+     returns EINPROGRESS and the traced version doesn't record those either. */
+  if (ret == 0 && !is_unix) {
+    record_socket_addrs(sockfd);
+  }
+  return ret;
+}
+#endif
+
 #ifdef SYS_setsockopt
 static long sys_setsockopt(struct syscall_info* call) {
   const int syscallno = SYS_setsockopt;
@@ -3398,6 +4216,30 @@ static long sys_xstat64(struct syscall_info* call) {
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
+/* Like sys_xstat64, but with different arguments */
+static long sys_fstatat(struct syscall_info* call) {
+  const int syscallno = call->no;
+  stat64_t* buf = (stat64_t*)call->args[2];
+
+  void* ptr = prep_syscall();
+  stat64_t* buf2 = NULL;
+  long ret;
+
+  if (buf) {
+    buf2 = ptr;
+    ptr += sizeof(*buf2);
+  }
+  if (!start_commit_buffered_syscall(syscallno, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  ret = untraced_syscall4(syscallno, call->args[0], call->args[1], buf2,
+                          call->args[3]);
+  if (buf2 && ret >= 0 && !buffer_hdr()->failed_during_preparation) {
+    local_memcpy(buf, buf2, sizeof(*buf));
+  }
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
 #ifdef SYS_statx
 /* Like sys_xstat64, but with different arguments */
 static long sys_statx(struct syscall_info* call) {
@@ -3565,6 +4407,27 @@ static long sys_writev(struct syscall_info* call) {
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
+/**
+ * Handles pwritev and pwritev2. These take the offset (and flags) in the
+ * remaining arguments, which we pass through unchanged.
+ */
+static long sys_generic_pwritev(struct syscall_info* call) {
+  const int syscallno = call->no;
+  int fd = call->args[0];
+
+  void* ptr = prep_syscall_for_fd(fd);
+  long ret;
+
+  if (!start_commit_buffered_syscall(syscallno, ptr, fd_write_blocks(fd))) {
+    return traced_raw_syscall(call);
+  }
+
+  ret = untraced_syscall6(syscallno, fd, call->args[1], call->args[2],
+                          call->args[3], call->args[4], call->args[5]);
+
+  return commit_raw_syscall(syscallno, ptr, ret);
+}
+
 static long sys_ptrace(struct syscall_info* call) {
   int syscallno = SYS_ptrace;
   long request = call->args[0];
@@ -3638,6 +4501,64 @@ static long sys_getrusage(struct syscall_info* call) {
   return commit_raw_syscall(syscallno, ptr, ret);
 }
 
+/**
+ * getresuid and getresgid (the 32-bit id versions on x86).
+ */
+static long sys_generic_getres(struct syscall_info* call) {
+  uint32_t* ids[3] = { (uint32_t*)call->args[0], (uint32_t*)call->args[1],
+                       (uint32_t*)call->args[2] };
+  void* ptr;
+  uint32_t* ids2;
+  long ret;
+  int i;
+
+  if (!ids[0] || !ids[1] || !ids[2]) {
+    /* Let the kernel write what it can and return EFAULT. */
+    return traced_raw_syscall(call);
+  }
+
+  ptr = prep_syscall();
+  ids2 = ptr;
+  ptr += 3 * sizeof(*ids2);
+  if (!start_commit_buffered_syscall(call->no, ptr, WONT_BLOCK)) {
+    return traced_raw_syscall(call);
+  }
+  ret = untraced_syscall3(call->no, &ids2[0], &ids2[1], &ids2[2]);
+  if (ret >= 0 && !buffer_hdr()->failed_during_preparation) {
+    for (i = 0; i < 3; ++i) {
+      *ids[i] = ids2[i];
+    }
+  }
+  return commit_raw_syscall(call->no, ptr, ret);
+}
+
+static long sys_capget(struct syscall_info* call) {
+  const int syscallno = SYS_capget;
+  cap_user_header_t hdr = (cap_user_header_t)call->args[0];
+  cap_user_data_t data = (cap_user_data_t)call->args[1];
+  int count;
+
+  assert(syscallno == call->no);
+
+  /* The kernel writes the version it wants to |hdr| if it doesn't like the
+     one passed in. Only buffer calls that don't do that. */
+  if (!hdr || !data) {
+    return traced_raw_syscall(call);
+  }
+  switch (hdr->version) {
+    case _LINUX_CAPABILITY_VERSION_1:
+      count = _LINUX_CAPABILITY_U32S_1;
+      break;
+    case _LINUX_CAPABILITY_VERSION_2:
+    case _LINUX_CAPABILITY_VERSION_3:
+      count = _LINUX_CAPABILITY_U32S_3;
+      break;
+    default:
+      return traced_raw_syscall(call);
+  }
+  return sys_generic_getter(call, 1, count * sizeof(*data), 0);
+}
+
 static long sys_rt_sigprocmask(struct syscall_info* call) {
   const int syscallno = SYS_rt_sigprocmask;
   long ret;
@@ -3754,14 +4675,31 @@ static long syscall_hook_internal(struct syscall_info* call) {
   case SYS_##syscallname:                                                      \
     return sys_generic_nonblocking_fd(call)
     CASE(rrcall_rdtsc);
+#if defined(SYS_accept)
+    case SYS_accept:
+      return sys_generic_accept(call);
+#endif
+#if defined(SYS_accept4)
+    case SYS_accept4:
+      return sys_generic_accept(call);
+#endif
 #if defined(SYS_access)
     CASE_GENERIC_NONBLOCKING(access);
 #endif
+    CASE_GENERIC_NONBLOCKING(faccessat);
+#if defined(SYS_faccessat2)
+    CASE_GENERIC_NONBLOCKING(faccessat2);
+#endif
+    CASE(capget);
     CASE(clock_gettime);
 #if defined(SYS_clock_gettime64)
     CASE(clock_gettime64);
 #endif
+    CASE(clock_nanosleep);
     CASE_GENERIC_NONBLOCKING_FD(close);
+#if defined(SYS_connect)
+    CASE(connect);
+#endif
 #if defined(SYS_creat)
     CASE(creat);
 #endif
@@ -3770,9 +4708,14 @@ static long syscall_hook_internal(struct syscall_info* call) {
 case SYS_epoll_wait:
 #endif
 case SYS_epoll_pwait:
+#if defined(SYS_epoll_pwait2)
+case SYS_epoll_pwait2:
+#endif
     return sys_epoll_wait(call);
     CASE_GENERIC_NONBLOCKING_FD(fadvise64);
     CASE_GENERIC_NONBLOCKING(fchmod);
+    CASE_GENERIC_NONBLOCKING(fchmodat);
+    CASE_GENERIC_NONBLOCKING(fchownat);
 #if defined(SYS_fcntl64)
     CASE(fcntl64);
 #else
@@ -3787,23 +4730,55 @@ case SYS_epoll_pwait:
     CASE(getdents);
 #endif
     CASE(getdents64);
+    case SYS_getcwd:
+      return sys_generic_getter(call, 0, call->args[1], 1);
     CASE_GENERIC_NONBLOCKING(getegid);
     CASE_GENERIC_NONBLOCKING(geteuid);
     CASE_GENERIC_NONBLOCKING(getgid);
+#if defined(SYS_getgroups32)
+    case SYS_getgroups32:
+#else
+    case SYS_getgroups:
+#endif
+      if ((int)call->args[0] < 0) {
+        return traced_raw_syscall(call);
+      }
+      /* The kernel never returns more than NGROUPS_MAX groups. */
+      return sys_generic_getter(
+          call, 1,
+          ((int)call->args[0] < 65536 ? (int)call->args[0] : 65536) *
+              sizeof(uint32_t),
+          sizeof(uint32_t));
     CASE_GENERIC_NONBLOCKING(getpid);
     CASE_GENERIC_NONBLOCKING(getppid);
+    CASE_GENERIC_NONBLOCKING(getpriority);
     CASE(getrandom);
+#if defined(SYS_getresuid32)
+    case SYS_getresuid32:
+    case SYS_getresgid32:
+#else
+    case SYS_getresuid:
+    case SYS_getresgid:
+#endif
+      return sys_generic_getres(call);
+#if defined(SYS_ugetrlimit)
+    case SYS_ugetrlimit:
+#else
+    case SYS_getrlimit:
+#endif
+      return sys_generic_getter(call, 1, sizeof(struct rlimit), 0);
     CASE(getrusage);
     CASE_GENERIC_NONBLOCKING(gettid);
     CASE(gettimeofday);
     CASE_GENERIC_NONBLOCKING(getuid);
     CASE(getxattr);
     CASE(ioctl);
-#if defined(lchown)
+#if defined(SYS_lchown)
     CASE_GENERIC_NONBLOCKING(lchown);
 #endif
     CASE(lgetxattr);
     CASE(listxattr);
+    CASE_GENERIC_NONBLOCKING(linkat);
     CASE(llistxattr);
 #if defined(SYS__llseek)
     CASE(_llseek);
@@ -3813,10 +4788,18 @@ case SYS_epoll_pwait:
 #if defined(SYS_mkdir)
     CASE_GENERIC_NONBLOCKING(mkdir);
 #endif
-#if defined(SYS_mkdor)
+    CASE_GENERIC_NONBLOCKING(mkdirat);
+#if defined(SYS_mknod)
     CASE_GENERIC_NONBLOCKING(mknod);
 #endif
+#if defined(__i386__)
+    case SYS_mmap2:
+#else
+    case SYS_mmap:
+#endif
+      return sys_mmap(call);
     CASE(mprotect);
+    CASE(munmap);
 #if defined(SYS_open)
     CASE(open);
 #endif
@@ -3827,10 +4810,34 @@ case SYS_epoll_pwait:
 #if defined(SYS_ppoll)
     CASE(ppoll);
 #endif
+    case SYS_pselect6:
+#if defined(SYS_select) && !defined(__i386__)
+    case SYS_select:
+#endif
+      return sys_generic_select(call);
 #if !defined(__i386__)
     CASE(pread64);
     CASE(pwrite64);
 #endif
+    case SYS_preadv:
+#if defined(SYS_preadv2)
+    case SYS_preadv2:
+#endif
+      return sys_generic_readv(call);
+    case SYS_pwritev:
+#if defined(SYS_pwritev2)
+    case SYS_pwritev2:
+#endif
+      return sys_generic_pwritev(call);
+#if defined(SYS_nanosleep)
+    CASE(nanosleep);
+#endif
+    case SYS_prlimit64:
+      if (call->args[2]) {
+        /* Only buffer queries. */
+        return traced_raw_syscall(call);
+      }
+      return sys_generic_getter(call, 3, sizeof(struct rlimit64), 0);
     CASE(ptrace);
     CASE(quotactl);
     CASE(read);
@@ -3839,16 +4846,35 @@ case SYS_epoll_pwait:
 #endif
     case SYS_readlinkat:
       return sys_readlinkat(call, 0);
+    case SYS_readv:
+      return sys_generic_readv(call);
 #if defined(SYS_recvfrom)
     CASE(recvfrom);
 #endif
+#if defined(SYS_recvmmsg)
+    CASE(recvmmsg);
+#endif
+#if defined(SYS_recvmmsg_time64)
+    case SYS_recvmmsg_time64:
+      return sys_recvmmsg(call);
+#endif
 #if defined(SYS_recvmsg)
     CASE(recvmsg);
 #endif
+#if defined(SYS_renameat)
+    CASE_GENERIC_NONBLOCKING(renameat);
+#endif
+#if defined(SYS_renameat2)
+    CASE_GENERIC_NONBLOCKING(renameat2);
+#endif
 #if defined(SYS_rmdir)
     CASE_GENERIC_NONBLOCKING(rmdir);
 #endif
     CASE(rt_sigprocmask);
+    CASE(sched_yield);
+#if defined(SYS_sendmmsg)
+    CASE(sendmmsg);
+#endif
 #if defined(SYS_sendmsg)
     CASE(sendmsg);
 #endif
@@ -3865,6 +4891,9 @@ case SYS_epoll_pwait:
     CASE(getsockname);
 #endif
     CASE_GENERIC_NONBLOCKING(setxattr);
+#if defined(SYS_shutdown)
+    CASE_GENERIC_NONBLOCKING_FD(shutdown);
+#endif
 #if defined(SYS_socketcall)
     CASE(socketcall);
 #endif
@@ -3874,10 +4903,15 @@ case SYS_epoll_pwait:
 #if defined(SYS_symlink)
     CASE_GENERIC_NONBLOCKING(symlink);
 #endif
+    CASE_GENERIC_NONBLOCKING(symlinkat);
+    case SYS_sysinfo:
+      return sys_generic_getter(call, 0, sizeof(struct sysinfo), 0);
 #if defined(SYS_time)
     CASE(time);
 #endif
     CASE_GENERIC_NONBLOCKING(truncate);
+    case SYS_uname:
+      return sys_generic_getter(call, 0, sizeof(struct new_utsname), 0);
 #if defined(SYS_unlink)
     CASE_GENERIC_NONBLOCKING(unlink);
 #endif
@@ -3901,6 +4935,13 @@ case SYS_epoll_pwait:
     case SYS_stat:
 #endif
       return sys_xstat64(call);
+#if defined(SYS_fstatat64)
+    case SYS_fstatat64:
+      return sys_fstatat(call);
+#elif defined(SYS_newfstatat)
+    case SYS_newfstatat:
+      return sys_fstatat(call);
+#endif
 #if defined(SYS_statx)
     case SYS_statx:
       return sys_statx(call);
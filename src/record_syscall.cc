@@ -778,15 +778,17 @@ void TaskSyscallState::process_syscall_results() {
     Registers r = t->regs();
     // Step 1: compute actual sizes of all buffers and copy outputs
     // from scratch back to their origin
+    vector<Task::MemoryTransfer> write_backs;
     for (size_t i = 0; i < param_list.size(); ++i) {
       auto& param = param_list[i];
       size_t size = eval_param_size(i, actual_sizes);
       if (write_back == WRITE_BACK &&
           (param.mode == IN_OUT || param.mode == OUT)) {
-        const uint8_t* d = data.data() + (param.scratch - t->scratch_ptr);
-        t->write_bytes_helper(param.dest, size, d);
+        uint8_t* d = data.data() + (param.scratch - t->scratch_ptr);
+        write_backs.push_back(Task::MemoryTransfer(param.dest, size, d));
       }
     }
+    t->write_bytes_batched(write_backs);
     bool memory_cleaned_up = false;
     // Step 2: restore modified in-memory pointers and registers
     for (size_t i = 0; i < param_list.size(); ++i) {
@@ -801,22 +803,43 @@ void TaskSyscallState::process_syscall_results() {
     }
     if (write_back == WRITE_BACK) {
       // Step 3: record all output memory areas
+      // If pointers in memory were fixed up in step 2, then record
+      // from tracee memory to ensure we record such fixes. Otherwise we
+      // can record from our local data.
+      // XXX This optimization can be improved if necessary...
+      auto from_tracee = [memory_cleaned_up](const MemoryParam& param) {
+        return param.mode == IN_OUT_NO_SCRATCH ||
+               (memory_cleaned_up &&
+                (param.mode == IN_OUT || param.mode == OUT));
+      };
+      // Read everything that has to come from the tracee in one batch.
+      vector<size_t> offsets(param_list.size());
+      size_t remote_size = 0;
+      for (size_t i = 0; i < param_list.size(); ++i) {
+        if (from_tracee(param_list[i])) {
+          offsets[i] = remote_size;
+          remote_size += actual_sizes[i];
+        }
+      }
+      vector<uint8_t> remote_data(remote_size);
+      vector<Task::MemoryTransfer> transfers;
+      for (size_t i = 0; i < param_list.size(); ++i) {
+        if (from_tracee(param_list[i]) && !param_list[i].dest.is_null()) {
+          transfers.push_back(Task::MemoryTransfer(
+              param_list[i].dest, actual_sizes[i],
+              remote_data.data() + offsets[i]));
+        }
+      }
+      t->maybe_flush_syscallbuf();
+      t->read_bytes_batched(transfers);
       for (size_t i = 0; i < param_list.size(); ++i) {
         auto& param = param_list[i];
         size_t size = actual_sizes[i];
-        if (param.mode == IN_OUT_NO_SCRATCH) {
-          t->record_remote(param.dest, size);
+        if (from_tracee(param)) {
+          t->record_local(param.dest, size, remote_data.data() + offsets[i]);
         } else if (param.mode == IN_OUT || param.mode == OUT) {
-          // If pointers in memory were fixed up in step 2, then record
-          // from tracee memory to ensure we record such fixes. Otherwise we
-          // can record from our local data.
-          // XXX This optimization can be improved if necessary...
-          if (memory_cleaned_up) {
-            t->record_remote(param.dest, size);
-          } else {
-            const uint8_t* d = data.data() + (param.scratch - t->scratch_ptr);
-            t->record_local(param.dest, size, d);
-          }
+          const uint8_t* d = data.data() + (param.scratch - t->scratch_ptr);
+          t->record_local(param.dest, size, d);
         }
       }
     }
@@ -856,13 +879,14 @@ void TaskSyscallState::process_syscall_results() {
     }
     ASSERT(t, saved_data.empty());
     // Step 3: record all output memory areas
+    vector<MemoryRange> ranges;
     for (size_t i = 0; i < param_list.size(); ++i) {
       auto& param = param_list[i];
-      size_t size = actual_sizes[i];
       if (param.mode != IN) {
-        t->record_remote(param.dest, size);
+        ranges.push_back(MemoryRange(param.dest, actual_sizes[i]));
       }
     }
+    t->record_remote(ranges);
   }
 
   if (should_emulate_result) {
@@ -4791,7 +4815,10 @@ static Switchable rec_prepare_syscall_arch(RecordTask* t,
           2, sizeof(typename Arch::epoll_event) * regs.arg3_signed());
       return ALLOW_SWITCH;
 
-    case Arch::epoll_pwait: {
+    /* int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents,
+     * const struct timespec *timeout, const sigset_t *sigmask); */
+    case Arch::epoll_pwait:
+    case Arch::epoll_pwait2: {
       syscall_state.reg_parameter(
           2, sizeof(typename Arch::epoll_event) * regs.arg3_signed());
       t->invalidate_sigmask();
@@ -1729,7 +1729,7 @@ clone3 = IrregularEmulatedSyscall(x86=435, x64=435, generic=435)
 openat2 = UnsupportedSyscall(x86=437, x64=437, generic=437)
 pidfd_getfd = UnsupportedSyscall(x86=438, x64=438, generic=438)
 process_madvise = UnsupportedSyscall(x86=440, x64=440, generic=440)
-epoll_pwait2 = UnsupportedSyscall(x86=441, x64=441, generic=441)
+epoll_pwait2 = IrregularEmulatedSyscall(x86=441, x64=441, generic=441)
 mount_setattr = UnsupportedSyscall(x86=442, x64=442, generic=442)
 quotactl_fd = UnsupportedSyscall(x86=443, x64=443, generic=443)
 landlock_create_ruleset = UnsupportedSyscall(x86=444, x64=444, generic=444)
@@ -1758,6 +1758,7 @@ rrcall_detach_teleport = IrregularEmulatedSyscall(x86=1009, x64=1009, generic=10
 rrcall_arm_time_slice = IrregularEmulatedSyscall(x86=1010, x64=1010, generic=1010)
 rrcall_freeze_tid = IrregularEmulatedSyscall(x86=1011, x64=1011, generic=1011)
 rrcall_rdtsc = IrregularEmulatedSyscall(x86=1012, x64=1012, generic=1012)
+rrcall_mmap_record = IrregularEmulatedSyscall(x86=1013, x64=1013, generic=1013)
 
 # These syscalls also appear under `socketcall` on x86.
 socket = EmulatedSyscall(x86=359, x64=41, generic=198)
@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+#define NUM_CONNECTIONS 10
+
+int main(void) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  struct sockaddr_in peer_addr;
+  int listenfd;
+  int i;
+
+  test_assert(0 <= (listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK,
+                                      0)));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(0 == bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)));
+  test_assert(0 == getsockname(listenfd, (struct sockaddr*)&addr, &len));
+  test_assert(0 == listen(listenfd, NUM_CONNECTIONS));
+
+  /* Nobody is connecting yet. */
+  len = sizeof(peer_addr);
+  test_assert(-1 == accept4(listenfd, (struct sockaddr*)&peer_addr, &len,
+                            SOCK_CLOEXEC));
+  test_assert(EAGAIN == errno || EWOULDBLOCK == errno);
+
+  for (i = 0; i < NUM_CONNECTIONS; ++i) {
+    int clientfd;
+    int servefd;
+    char c = 0;
+
+    test_assert(0 <= (clientfd = socket(AF_INET, SOCK_STREAM, 0)));
+    test_assert(0 == connect(clientfd, (struct sockaddr*)&addr, sizeof(addr)));
+
+    len = sizeof(peer_addr);
+    memset(&peer_addr, 0, sizeof(peer_addr));
+    if (i & 1) {
+      servefd = accept(listenfd, (struct sockaddr*)&peer_addr, &len);
+    } else {
+      servefd = accept4(listenfd, (struct sockaddr*)&peer_addr, &len,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC);
+    }
+    test_assert(servefd >= 0);
+    test_assert(len == sizeof(peer_addr));
+    test_assert(AF_INET == peer_addr.sin_family);
+    test_assert(htonl(INADDR_LOOPBACK) == peer_addr.sin_addr.s_addr);
+
+    test_assert(0 == shutdown(servefd, SHUT_WR));
+    test_assert(0 == read(clientfd, &c, 1));
+    test_assert(0 == shutdown(clientfd, SHUT_RDWR));
+
+    close(servefd);
+    close(clientfd);
+  }
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+int main(void) {
+  static const char dir_name[] = "rr-at-syscalls-dir";
+  struct stat st;
+  int dirfd;
+  int fd;
+  int ret;
+
+  test_assert(0 == mkdirat(AT_FDCWD, dir_name, 0700));
+  dirfd = open(dir_name, O_RDONLY | O_DIRECTORY);
+  test_assert(dirfd >= 0);
+
+  fd = openat(dirfd, "file", O_RDWR | O_CREAT | O_EXCL, 0600);
+  test_assert(fd >= 0);
+  test_assert(5 == write(fd, "hello", 5));
+  test_assert(0 == close(fd));
+
+  test_assert(0 == fstatat(dirfd, "file", &st, 0));
+  test_assert(S_ISREG(st.st_mode));
+  test_assert(st.st_size == 5);
+  test_assert(-1 == fstatat(dirfd, "missing", &st, 0));
+  test_assert(errno == ENOENT);
+  test_assert(0 == fstatat(dirfd, "", &st, AT_EMPTY_PATH));
+  test_assert(S_ISDIR(st.st_mode));
+
+  test_assert(0 == faccessat(dirfd, "file", R_OK | W_OK, 0));
+  test_assert(-1 == faccessat(dirfd, "missing", F_OK, 0));
+  test_assert(errno == ENOENT);
+#ifdef SYS_faccessat2
+  ret = syscall(SYS_faccessat2, dirfd, "file", F_OK, AT_EACCESS);
+  test_assert(ret == 0 || (ret == -1 && errno == ENOSYS));
+#endif
+
+  test_assert(0 == fchmodat(dirfd, "file", 0400, 0));
+  test_assert(0 == fstatat(dirfd, "file", &st, 0));
+  test_assert((st.st_mode & 0777) == 0400);
+  test_assert(0 == fchownat(dirfd, "file", geteuid(), getegid(), 0));
+
+  test_assert(0 == linkat(dirfd, "file", dirfd, "link", 0));
+  test_assert(0 == fstatat(dirfd, "link", &st, 0));
+  test_assert(st.st_nlink == 2);
+  test_assert(0 == symlinkat("file", dirfd, "symlink"));
+  test_assert(0 == fstatat(dirfd, "symlink", &st, AT_SYMLINK_NOFOLLOW));
+  test_assert(S_ISLNK(st.st_mode));
+
+  test_assert(0 == renameat(dirfd, "link", dirfd, "renamed"));
+#ifdef SYS_renameat2
+  ret = syscall(SYS_renameat2, dirfd, "renamed", dirfd, "file",
+                RENAME_NOREPLACE);
+  test_assert(ret == -1 && (errno == EEXIST || errno == ENOSYS ||
+                            errno == EINVAL));
+  ret = syscall(SYS_renameat2, dirfd, "renamed", dirfd, "renamed2", 0);
+  test_assert(ret == 0 || (ret == -1 && errno == ENOSYS));
+  if (ret == 0) {
+    test_assert(0 == renameat(dirfd, "renamed2", dirfd, "renamed"));
+  }
+#endif
+
+  test_assert(0 == unlinkat(dirfd, "renamed", 0));
+  test_assert(0 == unlinkat(dirfd, "symlink", 0));
+  test_assert(0 == unlinkat(dirfd, "file", 0));
+  test_assert(0 == close(dirfd));
+  test_assert(0 == unlinkat(AT_FDCWD, dir_name, AT_REMOVEDIR));
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
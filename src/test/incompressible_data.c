@@ -0,0 +1,31 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Record several compression blocks' worth of random data, which doesn't
+   compress, so the trace writer has to store those blocks as they are. */
+#define DATA_SIZE (8 * 1024 * 1024)
+#define CHUNK_SIZE (64 * 1024)
+
+int main(void) {
+  unsigned char* data = malloc(DATA_SIZE);
+  uint32_t checksum = 0;
+  size_t offset;
+  int fd = open("/dev/urandom", O_RDONLY);
+
+  test_assert(data != NULL);
+  test_assert(fd >= 0);
+  for (offset = 0; offset < DATA_SIZE; offset += CHUNK_SIZE) {
+    test_assert(CHUNK_SIZE == read(fd, data + offset, CHUNK_SIZE));
+  }
+  for (offset = 0; offset < DATA_SIZE; ++offset) {
+    checksum = checksum * 31 + data[offset];
+  }
+  /* Replay must see the same data. */
+  atomic_printf("checksum %x\n", checksum);
+
+  test_assert(0 == close(fd));
+  free(data);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Ioctls that the syscallbuf handles itself, called often enough that most
+   of them are buffered. */
+
+int main(void) {
+  int master;
+  int slave;
+  int pipe_fds[2];
+  int sock;
+  int i;
+  struct termios* tc;
+  struct winsize* w;
+  int* navail;
+  struct ifreq* ifr;
+  uint64_t* size64;
+  int on = 1;
+  int off = 0;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  test_assert(master >= 0);
+  test_assert(0 == grantpt(master) && 0 == unlockpt(master));
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  test_assert(slave >= 0);
+  test_assert(0 == pipe(pipe_fds));
+  test_assert(1 == write(pipe_fds[1], "x", 1));
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  test_assert(sock >= 0);
+
+  ALLOCATE_GUARD(tc, 'a');
+  ALLOCATE_GUARD(w, 'b');
+  ALLOCATE_GUARD(navail, 'c');
+  ALLOCATE_GUARD(ifr, 'd');
+  ALLOCATE_GUARD(size64, 'e');
+  for (i = 0; i < 100; ++i) {
+    test_assert(0 == ioctl(slave, TCGETS, tc));
+    VERIFY_GUARD(tc);
+    test_assert(0 == ioctl(slave, TCSETS, tc));
+
+    test_assert(0 == ioctl(slave, TIOCGWINSZ, w));
+    VERIFY_GUARD(w);
+
+    test_assert(0 == ioctl(pipe_fds[0], FIONREAD, navail));
+    VERIFY_GUARD(navail);
+    test_assert(*navail == 1);
+
+    test_assert(0 == ioctl(pipe_fds[0], FIONBIO, &on));
+    test_assert(fcntl(pipe_fds[0], F_GETFL) & O_NONBLOCK);
+    test_assert(0 == ioctl(pipe_fds[0], FIONBIO, &off));
+    test_assert(!(fcntl(pipe_fds[0], F_GETFL) & O_NONBLOCK));
+
+    memset(ifr, 0, sizeof(*ifr));
+    strcpy(ifr->ifr_name, "lo");
+    if (0 == ioctl(sock, SIOCGIFINDEX, ifr)) {
+      test_assert(ifr->ifr_ifindex > 0);
+    } else {
+      test_assert(errno == ENODEV);
+    }
+    VERIFY_GUARD(ifr);
+
+    *size64 = 77;
+    test_assert(-1 == ioctl(pipe_fds[0], BLKGETSIZE64, size64));
+    test_assert(errno == ENOTTY);
+    test_assert(*size64 == 77);
+    VERIFY_GUARD(size64);
+  }
+
+  atomic_printf("TCGETS lflag=0x%x, %dx%d\n", tc->c_lflag, w->ws_row,
+                w->ws_col);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
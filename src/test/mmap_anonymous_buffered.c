@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Allocator-style churn of private anonymous memory, which the syscallbuf
+   handles without stopping. */
+
+#define NUM_REGIONS 64
+
+int main(void) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  char* regions[NUM_REGIONS];
+  int i;
+  int round;
+
+  for (round = 0; round < 10; ++round) {
+    for (i = 0; i < NUM_REGIONS; ++i) {
+      size_t size = (i % 4 + 3) * page_size;
+      regions[i] = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      test_assert(regions[i] != MAP_FAILED);
+      test_assert(regions[i][0] == 0 && regions[i][size - 1] == 0);
+      memset(regions[i], i + round, size);
+      /* Split the mapping in two */
+      test_assert(0 == munmap(regions[i] + page_size, page_size));
+      test_assert(0 == mprotect(regions[i], page_size, PROT_READ));
+    }
+    for (i = 0; i < NUM_REGIONS; ++i) {
+      size_t size = (i % 4 + 3) * page_size;
+      test_assert(regions[i][0] == (char)(i + round));
+      test_assert(regions[i][size - 1] == (char)(i + round));
+      test_assert(0 == munmap(regions[i], size));
+    }
+  }
+
+  /* Failures must not change anything */
+  test_assert(-1 == munmap(regions[0] + 1, page_size) && errno == EINVAL);
+  test_assert(MAP_FAILED == mmap(NULL, 0, PROT_READ,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) &&
+              errno == EINVAL);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,103 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+#define NUM_MSGS 8
+#define NUM_SENT 3
+#define MSG_SIZE 64
+
+static void set_msg(struct mmsghdr* m, struct iovec* iov, char* buf,
+                    size_t len, struct sockaddr_storage* name,
+                    socklen_t name_len) {
+  memset(m, 0, sizeof(*m));
+  iov->iov_base = buf;
+  iov->iov_len = len;
+  m->msg_hdr.msg_iov = iov;
+  m->msg_hdr.msg_iovlen = 1;
+  if (name) {
+    m->msg_hdr.msg_name = name;
+    m->msg_hdr.msg_namelen = name_len;
+  }
+}
+
+static void send_msgs(int tx, struct mmsghdr* msgs, struct iovec* iovs,
+                      char (*bufs)[MSG_SIZE]) {
+  int i;
+  int ret;
+
+  for (i = 0; i < NUM_SENT; ++i) {
+    memset(bufs[i], 'a' + i, MSG_SIZE);
+    set_msg(&msgs[i], &iovs[i], bufs[i], 10 + i, NULL, 0);
+  }
+  ret = sendmmsg(tx, msgs, NUM_SENT, 0);
+  test_assert(ret == NUM_SENT);
+  for (i = 0; i < NUM_SENT; ++i) {
+    test_assert(msgs[i].msg_len == (unsigned int)(10 + i));
+  }
+}
+
+/* Ask for more messages than are queued; only NUM_SENT arrive. The name
+   buffers are 'name_len' bytes; the kernel always reports the size of a
+   sockaddr_in, truncating the address if it doesn't fit. */
+static void recv_msgs(int rx, struct mmsghdr* msgs, struct iovec* iovs,
+                      char (*bufs)[MSG_SIZE], struct sockaddr_storage* names,
+                      socklen_t name_len) {
+  int i;
+  int ret;
+
+  memset(bufs, 0, NUM_MSGS * MSG_SIZE);
+  memset(names, 0, NUM_MSGS * sizeof(*names));
+  for (i = 0; i < NUM_MSGS; ++i) {
+    set_msg(&msgs[i], &iovs[i], bufs[i], MSG_SIZE, &names[i], name_len);
+    msgs[i].msg_len = 0xdeadbeef;
+  }
+  ret = recvmmsg(rx, msgs, NUM_MSGS, MSG_DONTWAIT, NULL);
+  test_assert(ret == NUM_SENT);
+  for (i = 0; i < NUM_SENT; ++i) {
+    test_assert(msgs[i].msg_len == (unsigned int)(10 + i));
+    test_assert(bufs[i][0] == 'a' + i && bufs[i][9 + i] == 'a' + i);
+    test_assert(bufs[i][10 + i] == 0);
+    test_assert(msgs[i].msg_hdr.msg_namelen == sizeof(struct sockaddr_in));
+    test_assert(names[i].ss_family == AF_INET);
+    if (name_len >= sizeof(struct sockaddr_in)) {
+      test_assert(((struct sockaddr_in*)&names[i])->sin_port != 0);
+    }
+  }
+  for (i = NUM_SENT; i < NUM_MSGS; ++i) {
+    test_assert(msgs[i].msg_len == 0xdeadbeef);
+    test_assert(bufs[i][0] == 0);
+  }
+}
+
+int main(void) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int rx = socket(AF_INET, SOCK_DGRAM, 0);
+  int tx = socket(AF_INET, SOCK_DGRAM, 0);
+  struct mmsghdr msgs[NUM_MSGS];
+  struct iovec iovs[NUM_MSGS];
+  struct sockaddr_storage names[NUM_MSGS];
+  char bufs[NUM_MSGS][MSG_SIZE];
+  int ret;
+
+  test_assert(rx >= 0 && tx >= 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(0 == bind(rx, (struct sockaddr*)&addr, sizeof(addr)));
+  test_assert(0 == getsockname(rx, (struct sockaddr*)&addr, &addr_len));
+  test_assert(0 == connect(tx, (struct sockaddr*)&addr, sizeof(addr)));
+
+  send_msgs(tx, msgs, iovs, bufs);
+  recv_msgs(rx, msgs, iovs, bufs, names, sizeof(struct sockaddr_in));
+  send_msgs(tx, msgs, iovs, bufs);
+  recv_msgs(rx, msgs, iovs, bufs, names, sizeof(struct sockaddr_storage));
+  send_msgs(tx, msgs, iovs, bufs);
+  recv_msgs(rx, msgs, iovs, bufs, names, sizeof(sa_family_t));
+
+  ret = recvmmsg(rx, msgs, NUM_MSGS, MSG_DONTWAIT, NULL);
+  test_assert(ret == -1 && errno == EAGAIN);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+int main(void) {
+  struct utsname u1, u2;
+  struct rlimit rlim;
+  struct rlimit64 rlim64;
+  struct __user_cap_header_struct hdr;
+  struct __user_cap_data_struct data[2];
+  struct sysinfo info;
+  uid_t ruid, euid, suid;
+  gid_t rgid, egid, sgid;
+  gid_t* groups;
+  char buf[2];
+  int num_groups;
+  int i;
+
+  /* Repeat everything so some calls get buffered after the syscallbuf
+     has been set up and patched. */
+  for (i = 0; i < 10; ++i) {
+    test_assert(0 == uname(&u1));
+    test_assert(0 == uname(&u2));
+    test_assert(!strcmp(u1.sysname, u2.sysname));
+    test_assert(!strcmp(u1.release, u2.release));
+
+    test_assert(0 == getresuid(&ruid, &euid, &suid));
+    test_assert(ruid == getuid() && euid == geteuid());
+    test_assert(0 == getresgid(&rgid, &egid, &sgid));
+    test_assert(rgid == getgid() && egid == getegid());
+
+    num_groups = getgroups(0, NULL);
+    test_assert(num_groups >= 0);
+    groups = (gid_t*)malloc((num_groups + 1) * sizeof(*groups));
+    test_assert(num_groups == getgroups(num_groups + 1, groups));
+    free(groups);
+
+    test_assert(0 == getrlimit(RLIMIT_NOFILE, &rlim));
+    test_assert(0 == syscall(SYS_prlimit64, 0, RLIMIT_NOFILE, NULL, &rlim64));
+    test_assert(rlim.rlim_cur == rlim64.rlim_cur);
+
+    errno = 0;
+    test_assert(-1 != getpriority(PRIO_PROCESS, 0) || 0 == errno);
+
+    test_assert(0 == sysinfo(&info));
+    test_assert(info.uptime > 0);
+
+    /* Too small for any path. */
+    test_assert(NULL == getcwd(buf, 1));
+    test_assert(ERANGE == errno);
+
+    hdr.version = _LINUX_CAPABILITY_VERSION_3;
+    hdr.pid = 0;
+    test_assert(0 == syscall(SYS_capget, &hdr, data));
+    /* Ask the kernel for its preferred version. */
+    hdr.version = 0;
+    test_assert(0 == syscall(SYS_capget, &hdr, NULL));
+    test_assert(hdr.version != 0);
+  }
+
+  atomic_printf("%s %s\n", u1.sysname, u1.release);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Larger than the syscall buffer, so these reads are recorded individually
+   and repeats of the same data are deduplicated in the trace. */
+#define BUF_SIZE (2 * 1024 * 1024)
+#define READS 8
+
+static const char file_name[] = "tmp.bin";
+
+int main(void) {
+  char* buf = malloc(BUF_SIZE);
+  char* buf2 = malloc(BUF_SIZE);
+  int fd;
+  int i;
+
+  test_assert(buf && buf2);
+  for (i = 0; i < BUF_SIZE; ++i) {
+    buf[i] = (char)(i * 7);
+  }
+  fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  test_assert(fd >= 0);
+  test_assert(0 == unlink(file_name));
+  test_assert(write(fd, buf, BUF_SIZE) == BUF_SIZE);
+
+  for (i = 0; i < READS; ++i) {
+    memset(buf2, 0, BUF_SIZE);
+    test_assert(pread(fd, buf2, BUF_SIZE, 0) == BUF_SIZE);
+    test_assert(!memcmp(buf, buf2, BUF_SIZE));
+    if (i == READS / 2) {
+      /* Change the file so later reads return different data */
+      buf[0] = ~buf[0];
+      test_assert(pwrite(fd, buf, 1, 0) == 1);
+    }
+  }
+
+  test_assert(0 == close(fd));
+  free(buf);
+  free(buf2);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
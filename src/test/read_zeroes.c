@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Larger than the syscall buffer, so these reads are recorded individually
+   and their zero runs become holes in the trace. */
+#define BUF_SIZE (2 * 1024 * 1024)
+
+static const char file_name[] = "tmp.bin";
+
+static void check_read(int fd, char* expected, char* buf) {
+  /* Replay must zero the holes, not skip them */
+  memset(buf, 0xff, BUF_SIZE);
+  test_assert(pread(fd, buf, BUF_SIZE, 0) == BUF_SIZE);
+  test_assert(!memcmp(expected, buf, BUF_SIZE));
+}
+
+int main(void) {
+  char* expected = malloc(BUF_SIZE);
+  char* buf = malloc(BUF_SIZE);
+  int fd;
+  int i;
+
+  test_assert(expected && buf);
+
+  fd = open("/dev/zero", O_RDONLY);
+  test_assert(fd >= 0);
+  memset(expected, 0, BUF_SIZE);
+  check_read(fd, expected, buf);
+  test_assert(0 == close(fd));
+
+  /* Zero runs of various lengths and alignments between nonzero bytes */
+  for (i = 0; i < BUF_SIZE; i += 4096 + i % 4099) {
+    expected[i] = (char)(i | 1);
+  }
+  expected[BUF_SIZE - 1] = 1;
+  fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  test_assert(fd >= 0);
+  test_assert(0 == unlink(file_name));
+  test_assert(write(fd, expected, BUF_SIZE) == BUF_SIZE);
+  check_read(fd, expected, buf);
+
+  /* A zero run that reaches the end of the buffer */
+  expected[BUF_SIZE - 1] = 0;
+  test_assert(pwrite(fd, expected + BUF_SIZE - 1, 1, BUF_SIZE - 1) == 1);
+  check_read(fd, expected, buf);
+
+  test_assert(0 == close(fd));
+  free(expected);
+  free(buf);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -4,7 +4,9 @@
 
 static char data[10] = "0123456789";
 
-static void test(int use_preadv) {
+enum { USE_READV, USE_PREADV, USE_PREADV2 };
+
+static void test(int mode) {
   static const char name[] = "temp";
   int fd = open(name, O_CREAT | O_RDWR | O_EXCL, 0600);
   struct {
@@ -26,9 +28,15 @@ static void test(int use_preadv) {
   iovs[0].iov_len = sizeof(*part1);
   iovs[1].iov_base = part2;
   iovs[1].iov_len = sizeof(*part2);
-  if (use_preadv) {
+  if (mode == USE_PREADV) {
     /* Work around busted preadv prototype in older libcs */
     nread = syscall(SYS_preadv, fd, iovs, 2, (off_t)0, 0);
+  } else if (mode == USE_PREADV2) {
+    nread = syscall(SYS_preadv2, fd, iovs, 2, (off_t)0, 0, 0);
+    if (nread < 0 && errno == ENOSYS) {
+      atomic_puts("preadv2 not supported, skipping");
+      return;
+    }
   } else {
     test_assert(0 == lseek(fd, 0, SEEK_SET));
     nread = readv(fd, iovs, 2);
@@ -42,9 +50,46 @@ static void test(int use_preadv) {
   VERIFY_GUARD(part2);
 }
 
+/* Large enough to take the syscallbuf's block-cloning path on
+   filesystems that support it, and split across many iovecs */
+#define BIG_SIZE (256 * 1024)
+#define BIG_IOVS 16
+
+static void test_big(void) {
+  static const char name[] = "temp";
+  int fd = open(name, O_CREAT | O_RDWR | O_EXCL, 0600);
+  char* expected = malloc(BIG_SIZE);
+  char* buf = malloc(BIG_SIZE);
+  struct iovec iovs[BIG_IOVS];
+  int i;
+
+  test_assert(fd >= 0);
+  test_assert(expected && buf);
+  test_assert(0 == unlink(name));
+  for (i = 0; i < BIG_SIZE; ++i) {
+    expected[i] = (char)(i * 13);
+  }
+  test_assert(BIG_SIZE == write(fd, expected, BIG_SIZE));
+  test_assert(0 == lseek(fd, 0, SEEK_SET));
+
+  memset(buf, 0, BIG_SIZE);
+  for (i = 0; i < BIG_IOVS; ++i) {
+    iovs[i].iov_base = buf + i * (BIG_SIZE / BIG_IOVS);
+    iovs[i].iov_len = BIG_SIZE / BIG_IOVS;
+  }
+  test_assert(BIG_SIZE == readv(fd, iovs, BIG_IOVS));
+  test_assert(0 == memcmp(buf, expected, BIG_SIZE));
+
+  test_assert(0 == close(fd));
+  free(expected);
+  free(buf);
+}
+
 int main(void) {
-  test(0);
-  test(1);
+  test(USE_READV);
+  test(USE_PREADV);
+  test(USE_PREADV2);
+  test_big();
 
   atomic_puts("EXIT-SUCCESS");
   return 0;
@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+#ifndef SYS_epoll_pwait2
+#define SYS_epoll_pwait2 441
+#endif
+
+static int pipefds[2];
+
+static void check_select(int ready) {
+  fd_set rset;
+  fd_set wset;
+  struct timeval tv = { 0, 0 };
+  struct timespec ts = { 0, 0 };
+  sigset_t sigmask;
+
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  FD_ZERO(&wset);
+  FD_SET(pipefds[1], &wset);
+  test_assert(1 + ready == select(pipefds[1] + 1, &rset, &wset, NULL, &tv));
+  test_assert(ready == !!FD_ISSET(pipefds[0], &rset));
+  test_assert(FD_ISSET(pipefds[1], &wset));
+
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGCHLD);
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  test_assert(ready == pselect(pipefds[0] + 1, &rset, NULL, NULL, &ts,
+                               &sigmask));
+  test_assert(ready == !!FD_ISSET(pipefds[0], &rset));
+}
+
+static void check_epoll_pwait2(int epfd, int ready) {
+  struct epoll_event ev;
+  struct timespec ts = { 0, 0 };
+  sigset_t sigmask;
+  int ret;
+
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGCHLD);
+  memset(&ev, 0, sizeof(ev));
+  ret = syscall(SYS_epoll_pwait2, epfd, &ev, 1, &ts, &sigmask, 8);
+  if (ret < 0 && errno == ENOSYS) {
+    atomic_puts("epoll_pwait2 not supported, skipping");
+    return;
+  }
+  test_assert(ready == ret);
+  test_assert(!ready || ev.data.fd == pipefds[0]);
+}
+
+static volatile int caught_usr1;
+
+static void handle_usr1(__attribute__((unused)) int sig) { caught_usr1 = 1; }
+
+/* A pending signal that the call's mask unblocks must interrupt it, even
+   with a zero timeout. Nothing may be ready when this is called. */
+static void check_pending_signal(int epfd) {
+  struct epoll_event ev;
+  struct timespec ts = { 0, 0 };
+  sigset_t blocked;
+  sigset_t unblocked;
+  fd_set rset;
+
+  signal(SIGUSR1, handle_usr1);
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGUSR1);
+  test_assert(0 == sigprocmask(SIG_BLOCK, &blocked, &unblocked));
+  sigdelset(&unblocked, SIGUSR1);
+
+  caught_usr1 = 0;
+  raise(SIGUSR1);
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  test_assert(-1 == pselect(pipefds[0] + 1, &rset, NULL, NULL, &ts,
+                            &unblocked));
+  test_assert(EINTR == errno);
+  test_assert(caught_usr1);
+
+  caught_usr1 = 0;
+  raise(SIGUSR1);
+  test_assert(-1 == epoll_pwait(epfd, &ev, 1, 1000, &unblocked));
+  test_assert(EINTR == errno);
+  test_assert(caught_usr1);
+
+  test_assert(0 == sigprocmask(SIG_UNBLOCK, &blocked, NULL));
+}
+
+static void* write_after_delay(__attribute__((unused)) void* p) {
+  char ch = 'y';
+  usleep(100000);
+  test_assert(1 == write(pipefds[1], &ch, 1));
+  return NULL;
+}
+
+static void drain_pipe(void) {
+  char ch;
+  test_assert(1 == read(pipefds[0], &ch, 1));
+}
+
+/* Block with no timeout until another thread makes the pipe readable. */
+static void check_blocking_select(void) {
+  pthread_t thread;
+  fd_set rset;
+  int ret;
+
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  pthread_create(&thread, NULL, write_after_delay, NULL);
+  test_assert(1 == select(pipefds[0] + 1, &rset, NULL, NULL, NULL));
+  test_assert(FD_ISSET(pipefds[0], &rset));
+  pthread_join(thread, NULL);
+  drain_pipe();
+
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  pthread_create(&thread, NULL, write_after_delay, NULL);
+  ret = syscall(SYS_pselect6, pipefds[0] + 1, &rset, NULL, NULL, NULL, NULL);
+  test_assert(1 == ret);
+  test_assert(FD_ISSET(pipefds[0], &rset));
+  pthread_join(thread, NULL);
+  drain_pipe();
+}
+
+int main(void) {
+  struct epoll_event ev;
+  struct timeval tv = { 0, 100000 };
+  fd_set rset;
+  int epfd;
+  char ch = 'x';
+
+  test_assert(0 == pipe(pipefds));
+  test_assert(0 <= (epfd = epoll_create(1)));
+  ev.events = EPOLLIN;
+  ev.data.fd = pipefds[0];
+  test_assert(0 == epoll_ctl(epfd, EPOLL_CTL_ADD, pipefds[0], &ev));
+
+  check_select(0);
+  check_epoll_pwait2(epfd, 0);
+  check_pending_signal(epfd);
+  check_blocking_select();
+
+  /* Nothing is ready, so this has to wait for the timeout. */
+  FD_ZERO(&rset);
+  FD_SET(pipefds[0], &rset);
+  test_assert(0 == select(pipefds[0] + 1, &rset, NULL, NULL, &tv));
+  test_assert(!FD_ISSET(pipefds[0], &rset));
+
+  test_assert(1 == write(pipefds[1], &ch, 1));
+  check_select(1);
+  check_epoll_pwait2(epfd, 1);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+/* Polling loops like these should stay in the syscallbuf. */
+
+int main(void) {
+  struct timespec zero = { 0, 0 };
+  struct timespec past;
+  struct timespec* remain;
+  int i;
+
+  ALLOCATE_GUARD(remain, 'x');
+  remain->tv_sec = 9999;
+  remain->tv_nsec = 9998;
+  test_assert(0 == clock_gettime(CLOCK_MONOTONIC, &past));
+  for (i = 0; i < 1000; ++i) {
+    test_assert(0 == sched_yield());
+    test_assert(0 == syscall(SYS_sched_yield));
+    test_assert(0 == nanosleep(&zero, remain));
+    test_assert(0 == clock_nanosleep(CLOCK_MONOTONIC, 0, &zero, remain));
+    test_assert(0 == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &past,
+                                     remain));
+  }
+  VERIFY_GUARD(remain);
+  test_assert(remain->tv_sec == 9999 && remain->tv_nsec == 9998);
+
+  zero.tv_nsec = 1000;
+  test_assert(0 == nanosleep(&zero, remain));
+  test_assert(0 == clock_nanosleep(CLOCK_REALTIME, 0, &zero, NULL));
+  VERIFY_GUARD(remain);
+  test_assert(remain->tv_sec == 9999 && remain->tv_nsec == 9998);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "util.h"
+
+#define NUM_READS 20000
+#define READ_SIZE 512
+
+static volatile int done;
+
+static void* spin_thread(__attribute__((unused)) void* p) {
+  /* Keep another task runnable so the reader gets descheduled at
+     timeslice boundaries. */
+  while (!done) {
+  }
+  return NULL;
+}
+
+int main(void) {
+  char buf[READ_SIZE];
+  uint32_t checksum = 0;
+  pthread_t thread;
+  int fd = open("/dev/zero", O_RDONLY);
+  int i;
+  int j;
+
+  test_assert(fd >= 0);
+  test_assert(0 == pthread_create(&thread, NULL, spin_thread, NULL));
+
+  for (i = 0; i < NUM_READS; ++i) {
+    memset(buf, 1, sizeof(buf));
+    test_assert(READ_SIZE == read(fd, buf, sizeof(buf)));
+    for (j = 0; j < READ_SIZE; j += 64) {
+      checksum += buf[j] + 1;
+    }
+  }
+  test_assert(checksum == NUM_READS * (READ_SIZE / 64));
+
+  done = 1;
+  test_assert(0 == pthread_join(thread, NULL));
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -191,6 +191,9 @@ trap onexit EXIT
 workdir=`mktemp -dt rr-test-$TESTNAME-XXXXXXXXX`
 cd $workdir
 
+# Keep rr's per-user caches out of the developer's home directory.
+export XDG_CACHE_HOME="$workdir/cache"
+
 # XXX technically the trailing -XXXXXXXXXX isn't unique, since there
 # could be "foo-123456789" and "bar-123456789", but if that happens,
 # buy me a lottery ticket.
@@ -4,7 +4,9 @@
 
 static char data[10] = "0123456789";
 
-static void test(int use_pwritev) {
+enum { USE_WRITEV, USE_PWRITEV, USE_PWRITEV2 };
+
+static void test(int mode) {
   static const char name[] = "temp";
   int fd = open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
   struct {
@@ -20,9 +22,15 @@ static void test(int use_pwritev) {
   iovs[0].iov_len = 7;
   iovs[1].iov_base = data + iovs[0].iov_len;
   iovs[1].iov_len = sizeof(data) - iovs[0].iov_len;
-  if (use_pwritev) {
+  if (mode == USE_PWRITEV) {
     /* Work around busted pwritev prototype in older libcs */
     nwritten = syscall(SYS_pwritev, fd, iovs, 2, (off_t)0, 0);
+  } else if (mode == USE_PWRITEV2) {
+    nwritten = syscall(SYS_pwritev2, fd, iovs, 2, (off_t)0, 0, 0);
+    if (nwritten < 0 && errno == ENOSYS) {
+      atomic_puts("pwritev2 not supported, skipping");
+      return;
+    }
   } else {
     nwritten = writev(fd, iovs, 2);
   }
@@ -36,8 +44,9 @@ static void test(int use_pwritev) {
 }
 
 int main(void) {
-  test(0);
-  test(1);
+  test(USE_WRITEV);
+  test(USE_PWRITEV);
+  test(USE_PWRITEV2);
 
   atomic_puts("EXIT-SUCCESS");
   return 0;